@@ -1,139 +1,692 @@
-#include <stdio.h>
+#define _GNU_SOURCE // For sched_getcpu
 #include <string.h> // For memset and memcpy
 #include <stdlib.h> // For abort and other standard library functions
 #include "include/heap.h"
+#include "include/slab.h"
+#include "include/trace.h"
 #include <errno.h> // For ENOMEM
+#include <stddef.h> // For offsetof
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h> // For nanosleep
+#include <stdio.h> // For malloc_stats
+#include <malloc.h> // For struct mallinfo2
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
-#define ALIGNED_ALLOC_MAGIC 0x12345678
 
-heap_t g_heap;
-bin_t g_bins[BIN_COUNT] = {'\0'};
-char g_region[HEAP_INIT_SIZE] = {'\0'};
+// Per-thread cache: freed chunks up to TCACHE_MAX_SZ are kept in size classes
+// of TCACHE_CLASS_SZ bytes and handed back out without touching the arenas.
+#define TCACHE_CLASS_SZ 16
+#define TCACHE_CLASSES 64
+#define TCACHE_MAX_SZ (TCACHE_CLASSES * TCACHE_CLASS_SZ)
+#define TCACHE_BATCH 16 // chunks moved per refill / flush
+#define TCACHE_LIMIT 64 // cached chunks per class before a flush
+
+typedef struct
+{
+  bin_t bins[TCACHE_CLASSES];
+  uint counts[TCACHE_CLASSES];
+  bump_t bump; // Span of fresh memory, carved without a lock
+  struct arena *bump_arena; // The arena the span was cut from
+  int state; // 0 = unused, 1 = live, -1 = torn down at thread exit
+} tcache_t;
+
+// Arenas: independent heaps with a lock each, picked by the CPU the thread
+// is running on. They are carved from one reservation, ARENA_SIZE apart, so
+// the arena that owns a pointer follows from its address.
+#define ARENA_MAX 64
+#define ARENA_SIZE HEAP_INIT_SIZE
+
+// Set to anything but 0 to back the arenas with transparent huge pages.
+#define HUGE_PAGES_ENV "MYALLOC_HUGEPAGES"
+
+// Set to a number of ms to give back the pages of free chunks of at least
+// PURGE_LIMIT bytes once they have been free that long. The arenas purge
+// as they allocate; with PURGE_THREAD_ENV set to anything but 0 a thread
+// also purges them every half decay, so idle arenas shrink too.
+#define PURGE_ENV "MYALLOC_PURGE_MS"
+#define PURGE_THREAD_ENV "MYALLOC_PURGE_THREAD"
+#define PURGE_LIMIT 0x10000
+
+typedef struct arena
+{
+  pthread_mutex_t lock;
+  heap_t heap;
+  bin_t bins[BIN_COUNT];
+  int ready; // heap mapped in, set on first use
+} __attribute__((aligned(64))) arena_t;
+
+static arena_t g_arenas[ARENA_MAX];
+static char *g_arena_base;
+static uint g_arena_count;
 int g_init_flag = 0;
 
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_tcache_key;
+static __thread tcache_t t_cache __attribute__((tls_model("initial-exec")));
+
+// Mapped chunks and their options do not belong to any arena, the first
+// one stands in for them.
+#define g_heap (g_arenas[0].heap)
+
+static void tcache_destroy(void *arg);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+// Lock an arena, mapping its heap in the first time.
+static int arena_lock(arena_t *a)
+{
+  pthread_mutex_lock(&a->lock);
+  if (!a->ready)
+  {
+    for (int i = 0; i < BIN_COUNT; ++i)
+    {
+      a->heap.bins[i] = &(a->bins[i]);
+    }
+    if (!map_heap_at(&a->heap, g_arena_base + (size_t)(a - g_arenas) * ARENA_SIZE, ARENA_SIZE))
+    {
+      pthread_mutex_unlock(&a->lock);
+      return 0;
+    }
+    a->ready = 1;
+  }
+  return 1;
+}
+
+static void init_allocator_once(void)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  uint count = cpus < 1 ? 1 : cpus > ARENA_MAX ? ARENA_MAX : (uint)cpus;
+
+  const char *env = getenv(HUGE_PAGES_ENV);
+  uint huge = env != NULL && env[0] != '\0' && strcmp(env, "0") != 0 ? HEAP_HUGE_THP : HEAP_HUGE_OFF;
+
+  env = getenv(PURGE_ENV);
+  int purge = env != NULL && env[0] != '\0';
+  uint decay = purge ? (uint)strtoul(env, NULL, 10) : 0;
+
+  // Huge pages need every arena to start on a huge page boundary, so
+  // reserve one more and trim the ends below.
+  size_t slack = huge != HEAP_HUGE_OFF ? HEAP_HUGE_PAGE_SIZE : 0;
+
+  // Only address space is reserved here, each arena maps its pages in as
+  // needed. Settle for fewer arenas if the reservation is too big.
+  char *base = MAP_FAILED;
+  for (; count > 0; count /= 2)
+  {
+    base = mmap(NULL, (size_t)count * ARENA_SIZE + slack, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base != MAP_FAILED)
+    {
+      break;
+    }
+  }
+  if (base == MAP_FAILED)
+  {
+    g_init_flag = -1;
+    return;
+  }
+
+  if (slack != 0)
+  {
+    char *aligned = (char *)(((uintptr_t)base + slack - 1) & ~((uintptr_t)slack - 1));
+    if (aligned != base)
+    {
+      munmap(base, aligned - base);
+    }
+    munmap(aligned + (size_t)count * ARENA_SIZE, base + slack - aligned);
+    base = aligned;
+  }
+
+  g_arena_base = base;
+  g_arena_count = count;
+  for (uint i = 0; i < count; ++i)
+  {
+    pthread_mutex_init(&g_arenas[i].lock, NULL);
+    g_arenas[i].heap.opts.huge = huge;
+    g_arenas[i].heap.opts.purge_limit = purge ? PURGE_LIMIT : 0;
+    g_arenas[i].heap.opts.purge_decay = decay;
+  }
+  if (!arena_lock(&g_arenas[0]))
+  {
+    g_init_flag = -1;
+    return;
+  }
+  pthread_mutex_unlock(&g_arenas[0].lock);
+
+  pthread_key_create(&g_tcache_key, tcache_destroy);
+  g_init_flag = 1;
+
+  // Registered once the allocator is up, as glibc may malloc in here.
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
 // Initialization function
 int init_allocator()
 {
   if (!g_init_flag)
   {
-    // fprintf(stderr, "Initializing heap.\n");
-    for (int i = 0; i < BIN_COUNT; ++i)
+    pthread_once(&g_init_once, init_allocator_once);
+  }
+  return g_init_flag > 0 ? 0 : -1; // 0 indicates success
+}
+
+static void *purge_thread(void *arg)
+{
+  (void)arg;
+  uint decay = g_heap.opts.purge_decay;
+  long ms = decay < 2 ? 1 : decay / 2;
+  struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+  for (;;)
+  {
+    nanosleep(&delay, NULL);
+    for (uint i = 0; i < g_arena_count; ++i)
+    {
+      arena_t *a = &g_arenas[i];
+      pthread_mutex_lock(&a->lock);
+      if (a->ready)
+      {
+        heap_purge(&a->heap);
+      }
+      pthread_mutex_unlock(&a->lock);
+    }
+  }
+  return NULL;
+}
+
+// Runs when the library is loaded. The thread is started here rather than
+// in init_allocator_once, where creating it could call back into malloc.
+__attribute__((constructor))
+static void purge_start(void)
+{
+  const char *env = getenv(PURGE_THREAD_ENV);
+  if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0)
+  {
+    return;
+  }
+  if (init_allocator() != 0 || g_heap.purge_min == 0)
+  {
+    return;
+  }
+
+  pthread_t purger;
+  if (pthread_create(&purger, NULL, purge_thread, NULL) == 0)
+  {
+    pthread_detach(purger);
+  }
+}
+
+node_t *wrapper_get_node(void *p)
+{
+  node_t *head = (node_t *)((char *)p - offsetof(node_t, next));
+  return head;
+}
+
+// The arena p was allocated from, or NULL for a mapped chunk.
+static arena_t *arena_of(void *p)
+{
+  uintptr_t off = (uintptr_t)p - (uintptr_t)g_arena_base;
+  return off < (uintptr_t)g_arena_count * ARENA_SIZE ? &g_arenas[off / ARENA_SIZE] : NULL;
+}
+
+static heap_t *heap_of(void *p)
+{
+  arena_t *a = arena_of(p);
+  return a != NULL ? &a->heap : &g_heap;
+}
+
+// Mapped chunks are the only ones outside of the arenas.
+static int is_mapped(void *p)
+{
+  return arena_of(p) == NULL;
+}
+
+// The arena for the CPU this thread is on. Threads move between CPUs, so
+// this is only a hint for spreading the load; frees go to the owner.
+static arena_t *arena_pick(void)
+{
+  int cpu = sched_getcpu();
+  if (cpu < 0)
+  {
+    cpu = (int)((uintptr_t)&t_cache >> 12); // hash of the thread instead
+  }
+  return &g_arenas[(uint)cpu % g_arena_count];
+}
+
+static void *central_alloc(size_t size)
+{
+  // Mapped chunks never touch the heap state, so they need no lock.
+  if (size >= g_heap.opts.mmap_threshold)
+  {
+    return heap_alloc(&g_heap, size);
+  }
+
+  arena_t *a = arena_pick();
+  if (!arena_lock(a))
+  {
+    return NULL;
+  }
+  void *p = heap_alloc(&a->heap, size);
+  pthread_mutex_unlock(&a->lock);
+  return p;
+}
+
+static void central_free(void *p)
+{
+  arena_t *a = arena_of(p);
+  if (a == NULL)
+  {
+    heap_free(&g_heap, p);
+    return;
+  }
+
+  // Chunks of another CPU's arena are queued for it with one atomic push,
+  // rather than taking its lock.
+  if (a != arena_pick())
+  {
+    heap_free_remote(&a->heap, p);
+    return;
+  }
+
+  pthread_mutex_lock(&a->lock);
+  heap_free(&a->heap, p);
+  pthread_mutex_unlock(&a->lock);
+}
+
+static inline void tcache_push(tcache_t *tc, uint cls, node_t *node)
+{
+  node->next = tc->bins[cls].head;
+  tc->bins[cls].head = node;
+  tc->counts[cls]++;
+}
+
+static inline node_t *tcache_pop(tcache_t *tc, uint cls)
+{
+  node_t *node = tc->bins[cls].head;
+  if (node != NULL)
+  {
+    tc->bins[cls].head = node->next;
+    tc->counts[cls]--;
+  }
+  return node;
+}
+
+static tcache_t *tcache_get(void)
+{
+  tcache_t *tc = &t_cache;
+  if (tc->state == 0)
+  {
+    // Live first: for keys past the first 32 glibc callocs the key's block
+    // in here, and that calloc must find the cache set up, not set it up
+    // again.
+    tc->state = 1;
+    // A non-NULL key value makes the destructor run when the thread exits.
+    pthread_setspecific(g_tcache_key, tc);
+  }
+  return tc->state > 0 ? tc : NULL;
+}
+
+// Give what is left of the thread's span back to the arena it was cut from.
+static void tcache_bump_release(tcache_t *tc)
+{
+  arena_t *a = tc->bump_arena;
+  if (a == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock(&a->lock);
+  heap_bump_release(&a->heap, &tc->bump);
+  pthread_mutex_unlock(&a->lock);
+  tc->bump_arena = NULL;
+}
+
+// Fill an empty class. Chunks that slabs do not serve are carved from the
+// thread's span while it lasts, one at a time and without a lock. Otherwise
+// a batch is taken from one arena under one lock, and the arena hands out a
+// new span instead if it has nothing free that fits.
+static node_t *tcache_refill(tcache_t *tc, uint cls)
+{
+  size_t chunk_size = (size_t)(cls + 1) * TCACHE_CLASS_SZ;
+  int bump = chunk_size > g_heap.slab_max;
+  if (bump)
+  {
+    void *p = heap_bump_alloc(&tc->bump, chunk_size);
+    if (p != NULL)
+    {
+      return wrapper_get_node(p);
+    }
+    tcache_bump_release(tc); // Too little left for this class
+  }
+
+  arena_t *a = arena_pick();
+  if (!arena_lock(a))
+  {
+    return NULL;
+  }
+  if (bump && heap_bump_reserve(&a->heap, &tc->bump, chunk_size, BUMP_SPAN_SIZE))
+  {
+    tc->bump_arena = a;
+    pthread_mutex_unlock(&a->lock);
+    return wrapper_get_node(heap_bump_alloc(&tc->bump, chunk_size));
+  }
+  for (int i = 0; i < TCACHE_BATCH; ++i)
+  {
+    void *p = heap_alloc(&a->heap, chunk_size);
+    if (p == NULL)
+    {
+      break;
+    }
+    tcache_push(tc, cls, wrapper_get_node(p));
+  }
+  pthread_mutex_unlock(&a->lock);
+
+  return tcache_pop(tc, cls);
+}
+
+// Return up to n chunks of a class to the arenas they came from. Chunks of
+// this CPU's arena are freed under one lock, the rest are queued remotely.
+static void tcache_flush(tcache_t *tc, uint cls, uint n)
+{
+  arena_t *mine = arena_pick();
+  int locked = 0;
+  while (n-- > 0)
+  {
+    node_t *node = tcache_pop(tc, cls);
+    if (node == NULL)
+    {
+      break;
+    }
+    arena_t *a = arena_of(&node->next);
+    if (a != mine)
     {
-      g_heap.bins[i] = &(g_bins[i]);
+      heap_free_remote(&a->heap, &node->next);
+      continue;
     }
-    init_heap(&g_heap, (long)(&g_region));
-    g_init_flag = 1;
-    // fprintf(stderr, "Heap initialized successfully.\n");
+    if (!locked)
+    {
+      pthread_mutex_lock(&mine->lock);
+      locked = 1;
+    }
+    heap_free(&mine->heap, &node->next);
+  }
+  if (locked)
+  {
+    pthread_mutex_unlock(&mine->lock);
+  }
+}
+
+// Fork: the child gets only the forking thread, so no arena lock may be
+// held by another thread across the fork. Every arena is locked in index
+// order, which is safe as nothing holds two of them at once.
+static void fork_prepare(void)
+{
+  for (uint i = 0; i < g_arena_count; ++i)
+  {
+    pthread_mutex_lock(&g_arenas[i].lock);
+  }
+}
+
+static void fork_parent(void)
+{
+  for (uint i = g_arena_count; i-- > 0;)
+  {
+    pthread_mutex_unlock(&g_arenas[i].lock);
+  }
+}
+
+// The locks start over in the child, and the thread's cache and span go
+// back to the arenas, so the child starts from heaps that hold all of its
+// free memory. The caches and spans of the threads left behind are lost
+// with them.
+static void fork_child(void)
+{
+  for (uint i = 0; i < g_arena_count; ++i)
+  {
+    pthread_mutex_init(&g_arenas[i].lock, NULL);
+  }
+
+  tcache_t *tc = &t_cache;
+  if (tc->state > 0)
+  {
+    for (uint cls = 0; cls < TCACHE_CLASSES; ++cls)
+    {
+      tcache_flush(tc, cls, tc->counts[cls]);
+    }
+    tcache_bump_release(tc);
+  }
+}
+
+static void tcache_destroy(void *arg)
+{
+  tcache_t *tc = (tcache_t *)arg;
+  for (uint cls = 0; cls < TCACHE_CLASSES; ++cls)
+  {
+    tcache_flush(tc, cls, tc->counts[cls]);
+  }
+  tcache_bump_release(tc);
+  // Late frees from other destructors go straight to the arenas.
+  tc->state = -1;
+}
+
+// Small requests are rounded up to their thread cache class wherever they
+// are served from, so the chunk for a request of size bytes always fits the
+// class malloc looks size up in, and free_sized can cache it there unseen.
+static inline size_t class_size(size_t size)
+{
+  if (size > TCACHE_MAX_SZ)
+  {
+    return size;
+  }
+  return (size + TCACHE_CLASS_SZ - 1) & ~(size_t)(TCACHE_CLASS_SZ - 1);
+}
+
+static void *cached_alloc(size_t size)
+{
+  tcache_t *tc;
+  if (size > TCACHE_MAX_SZ || (tc = tcache_get()) == NULL)
+  {
+    return central_alloc(class_size(size));
+  }
+
+  uint cls = (size - 1) / TCACHE_CLASS_SZ;
+  node_t *node = tcache_pop(tc, cls);
+  if (node == NULL)
+  {
+    node = tcache_refill(tc, cls);
   }
-  return 0; // Indicate success
+  return node == NULL ? NULL : &node->next;
+}
+
+// Cache p in class cls, or free it to its arena if there is no such class.
+static void cached_free_in(void *p, size_t cls)
+{
+  // Only node->next is used to link cached chunks, and it is the first word
+  // of the user data, so slab objects can be cached the same way.
+  node_t *node = wrapper_get_node(p);
+  tcache_t *tc;
+  if (cls >= TCACHE_CLASSES || (tc = tcache_get()) == NULL)
+  {
+    central_free(p);
+    return;
+  }
+
+  tcache_push(tc, cls, node);
+  if (tc->counts[cls] > TCACHE_LIMIT)
+  {
+    tcache_flush(tc, cls, TCACHE_BATCH);
+  }
+}
+
+static void cached_free(void *p)
+{
+  // Any chunk of at least (cls + 1) * TCACHE_CLASS_SZ bytes can serve class cls.
+  size_t cls = heap_usable_size(heap_of(p), p) / TCACHE_CLASS_SZ;
+  if (cls == 0)
+  {
+    central_free(p);
+    return;
+  }
+  cached_free_in(p, cls - 1);
 }
 
 void *malloc(size_t size)
 {
   init_allocator();
-  fprintf(stderr, "Try to malloc(%ld).\n", size);
   if (size == 0)
   {
     return NULL;
   }
-  void *p = heap_alloc(&g_heap, size);
-  fprintf(stderr, "==> malloc(%ld) = %p.\n", size, p);
+  void *p = cached_alloc(size);
+  trace_event(TRACE_MALLOC, p, NULL, size);
   return p;
 }
 
 void *calloc(size_t count, size_t size)
 {
   init_allocator();
-  size_t realsize = count * size;
+  size_t realsize;
+  if (__builtin_mul_overflow(count, size, &realsize))
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
   if (realsize == 0)
   {
     return NULL;
   }
-  fprintf(stderr, "Try to calloc(%ld, %ld) = %ld.\n", count, size, realsize);
-  char *p = heap_alloc(&g_heap, realsize);
-  if (p != NULL)
-  {                         // Check if allocation was successful before zeroing
-    memset(p, 0, realsize); // Use memset for efficient zeroing
+
+  void *p;
+  if (realsize <= TCACHE_MAX_SZ)
+  {
+    // Small and most likely reused, just clear it.
+    p = cached_alloc(realsize);
+    if (p != NULL)
+    {
+      memset(p, 0, realsize);
+    }
   }
-  fprintf(stderr, "==> calloc(%ld) = %p.\n", realsize, p);
+  else if (realsize >= g_heap.opts.mmap_threshold)
+  {
+    // A fresh mapping, zero already and no lock needed.
+    p = heap_calloc(&g_heap, 1, realsize);
+  }
+  else
+  {
+    // The heap only clears what is not known to be zero.
+    arena_t *a = arena_pick();
+    p = NULL;
+    if (arena_lock(a))
+    {
+      p = heap_calloc(&a->heap, 1, realsize);
+      pthread_mutex_unlock(&a->lock);
+    }
+  }
+  trace_event(TRACE_CALLOC, p, NULL, realsize);
   return p;
 }
 
-node_t *wrapper_get_node(void *p)
+void free(void *p)
 {
-  node_t *head = (node_t *)((char *)p - 8);
-  return head;
+  if (p == NULL)
+  {
+    return;
+  }
+
+  trace_event(TRACE_FREE, p, NULL, 0);
+  cached_free(p);
 }
 
-void free(void *p)
+// C23 sized frees. The size is what was asked for, and the chunk was
+// rounded up to the class malloc looks that size up in, see class_size. So
+// small chunks go back to that class without reading the heap's metadata.
+void free_sized(void *p, size_t size)
 {
   if (p == NULL)
   {
-    fprintf(stderr, "free(NULL) called.\n");
     return;
   }
 
-  size_t* metadata_ptr = (size_t*)(p - sizeof(size_t) * 2);
-  if (metadata_ptr[0] == ALIGNED_ALLOC_MAGIC) {
-    void *original_ptr = (void*)metadata_ptr[1];
-    heap_free(&g_heap, original_ptr);
+  trace_event(TRACE_FREE, p, NULL, 0);
+  if (size == 0 || size > TCACHE_MAX_SZ)
+  {
+    cached_free(p);
     return;
   }
+  cached_free_in(p, (size - 1) / TCACHE_CLASS_SZ);
+}
 
-  fprintf(stderr, "free(%p) - allocated with malloc/calloc/realloc, freeing directly.\n", p);
-  heap_free(&g_heap, p);
-  fprintf(stderr, "free(%p) Success!\n", p);
+void free_aligned_sized(void *p, size_t alignment, size_t size)
+{
+  // Aligned chunks are ordinary chunks once they are handed out.
+  (void)alignment;
+  free_sized(p, size);
 }
 
 void *realloc(void *p, size_t size)
 {
   init_allocator();
 
-  fprintf(stderr, "Try to realloc(%p, %ld).\n", p, size);
-
   if (p == NULL)
   {
-    void *ret = malloc(size);
-    fprintf(stderr, "realloc(NULL, %ld) equivalent to malloc, returning %p.\n", size, ret);
-    return ret; // realloc on NULL is same as malloc
+    // realloc on NULL is same as malloc
+    void *ret = size == 0 ? NULL : cached_alloc(size);
+    trace_event(TRACE_REALLOC, ret, NULL, size);
+    return ret;
   }
 
   if (size == 0)
   {
-    free(p); // realloc to 0 is same as free and return NULL
-    fprintf(stderr, "realloc(%p, 0) equivalent to free and returning NULL.\n", p);
+    // realloc to 0 is same as free and return NULL
+    trace_event(TRACE_REALLOC, NULL, p, 0);
+    cached_free(p);
     return NULL;
   }
-  node_t *node = wrapper_get_node(p);
-  size_t old_size = node->size;
+  size_t old_size = heap_usable_size(heap_of(p), p);
+  size_t want = class_size(size);
+  void *ret = p;
 
-  if (size <= old_size)
+  if (want <= old_size && old_size - want <= overhead + MIN_ALLOC_SZ)
   {
-    fprintf(stderr, "realloc(%p, %ld) requested size is <= old size, returning original pointer.\n", p, size);
-    return p;
+    // Not worth moving for the few bytes it would give back.
   }
-
-  char *ret = heap_alloc(&g_heap, size);
-  if (ret != NULL)
+  else if (is_mapped(p) && size >= g_heap.opts.mmap_threshold)
   {
-    memcpy(ret, p, MIN(old_size, size)); // Copy the smaller of the two sizes
-    free(p);
-    fprintf(stderr, "realloc(%p, %ld) allocated new block %p, copied %ld bytes, and freed old block.\n", p, size, ret, MIN(old_size, size));
+    // Resizing a mapped chunk only remaps it: no copy and no lock.
+    ret = heap_realloc(&g_heap, p, size);
   }
   else
   {
-    fprintf(stderr, "realloc(%p, %ld) allocation failed, returning NULL.\n", p, size);
-    return NULL;
+    // Grow into the free chunk after this one, or give the tail back.
+    arena_t *a = arena_of(p);
+    uint resized = 0;
+    if (a != NULL)
+    {
+      pthread_mutex_lock(&a->lock);
+      resized = heap_resize(&a->heap, p, want);
+      pthread_mutex_unlock(&a->lock);
+    }
+
+    if (!resized)
+    {
+      ret = cached_alloc(size);
+      if (ret != NULL)
+      {
+        memcpy(ret, p, MIN(old_size, size)); // Copy the smaller of the two sizes
+        cached_free(p);
+      }
+    }
   }
-  fprintf(stderr, "==> realloc(%p, %ld) = %p.\n", p, size, ret);
+
+  trace_event(TRACE_REALLOC, ret, p, size);
   return ret;
 }
 
 // Historically equivalent to free, but now deprecated.  Just call free.
 void cfree(void *p)
 {
-  fprintf(stderr, "cfree(%p) called (equivalent to free).\n", p);
   free(p);
 }
 
@@ -146,48 +699,145 @@ void *aligned_alloc_custom(size_t alignment, size_t size) {
 
   if (size == 0) return NULL; // malloc(0) 的行为依赖于实现
 
-  // 1. Allocate extra memory to ensure alignment can be met and store metadata.
-  size_t total_size = size + 2 * alignment + sizeof(size_t) * 2; // Extra space for alignment + metadata
+  // Every chunk is HEAP_ALIGN aligned already.
+  if (alignment <= HEAP_ALIGN) {
+    return malloc(size);
+  }
 
-  void *ptr = malloc(total_size);
-  if (ptr == NULL) {
-    return NULL;
+  // The heap splits the slack in front of the aligned chunk off as a free
+  // chunk, so the result is an ordinary chunk that free() handles as usual.
+  init_allocator();
+  arena_t *a = arena_pick();
+  void *ptr = NULL;
+  if (arena_lock(a))
+  {
+    ptr = heap_alloc_aligned(&a->heap, alignment, class_size(size));
+    pthread_mutex_unlock(&a->lock);
   }
 
-  // 2. Calculate the aligned address.
-  uintptr_t raw_address = (uintptr_t)ptr;
-  uintptr_t aligned_address = (raw_address + alignment + sizeof(size_t) * 2) & ~(alignment - 1);
+  if (ptr == NULL) {
+    errno = ENOMEM;
+  }
+  trace_event(TRACE_ALIGNED, ptr, (void *)alignment, size);
+  return ptr;
+}
 
-  // 3. Store the original pointer and magic number before the aligned address.
-  size_t* metadata_ptr = (size_t*)(aligned_address - sizeof(size_t) * 2);
-  metadata_ptr[0] = ALIGNED_ALLOC_MAGIC;
-  metadata_ptr[1] = (size_t)ptr; // Store the original pointer
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+  {
+    return EINVAL;
+  }
 
-  // 4. Return the aligned address.
-  return (void *)aligned_address;
+  void *p = aligned_alloc_custom(alignment, size);
+  if (p == NULL && size != 0)
+  {
+    return ENOMEM; // *memptr is left alone on failure
+  }
+  *memptr = p;
+  return 0;
 }
 
-int posix_memalign(void **memptr, size_t alignment, size_t size)
+void *aligned_alloc(size_t alignment, size_t size)
 {
-  fprintf(stderr, "posix_memalign(0x%lx, %ld, %ld) called, using malloc.\n", (unsigned long)memptr, alignment, size);
-  *memptr = aligned_alloc_custom(alignment, size);
-  return (*memptr == NULL) ? ENOMEM : 0;
+  return aligned_alloc_custom(alignment, size);
 }
 
 void *memalign(size_t alignment, size_t size)
 {
-  fprintf(stderr, "memalign(%ld, %ld) called, using malloc.\n", alignment, size);
   return aligned_alloc_custom(alignment, size);
 }
 
 void *valloc(size_t size)
 {
-  fprintf(stderr, "valloc(%ld) called, using malloc.\n", size);
-  return malloc(size);
+  return aligned_alloc_custom(HEAP_PAGE_SIZE, size);
 }
 
 void *pvalloc(size_t size)
 {
-  fprintf(stderr, "pvalloc(%ld) called, using malloc.\n", size);
-  return malloc(size);
+  // pvalloc rounds the size up to whole pages, and 0 to one page
+  size_t rounded = (size + HEAP_PAGE_SIZE - 1) & ~((size_t)HEAP_PAGE_SIZE - 1);
+  if (rounded < size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return aligned_alloc_custom(HEAP_PAGE_SIZE, rounded == 0 ? HEAP_PAGE_SIZE : rounded);
+}
+
+// Stats of arena i, or 0 if it has not been used yet.
+static int arena_stats(uint i, heap_stats_t *stats)
+{
+  arena_t *a = &g_arenas[i];
+  pthread_mutex_lock(&a->lock);
+  int ready = a->ready;
+  if (ready)
+  {
+    heap_get_stats(&a->heap, stats);
+  }
+  pthread_mutex_unlock(&a->lock);
+  return ready;
+}
+
+// Same layout as glibc: one block per arena, then the totals.
+void malloc_stats(void)
+{
+  if (init_allocator() != 0)
+  {
+    return;
+  }
+
+  heap_stats_t stats;
+  size_t system = 0, in_use = 0;
+  for (uint i = 0; i < g_arena_count; ++i)
+  {
+    if (!arena_stats(i, &stats))
+    {
+      continue;
+    }
+    fprintf(stderr, "Arena %u:\n", i);
+    fprintf(stderr, "system bytes     = %10zu\n", stats.heap_bytes);
+    fprintf(stderr, "in use bytes     = %10zu\n", stats.live_bytes);
+    system += stats.heap_bytes;
+    in_use += stats.live_bytes;
+  }
+
+  // Mapped chunks are counted by the first arena.
+  arena_stats(0, &stats);
+  size_t regions = stats.counters.mmaps - stats.counters.munmaps;
+  fprintf(stderr, "Total (incl. mmap):\n");
+  fprintf(stderr, "system bytes     = %10zu\n", system + stats.counters.mmapped);
+  fprintf(stderr, "in use bytes     = %10zu\n", in_use + stats.counters.mmapped);
+  fprintf(stderr, "mmap regions     = %10zu\n", regions);
+  fprintf(stderr, "mmap bytes       = %10zu\n", stats.counters.mmapped);
+}
+
+struct mallinfo2 mallinfo2(void)
+{
+  struct mallinfo2 info;
+  memset(&info, 0, sizeof(info));
+  if (init_allocator() != 0)
+  {
+    return info;
+  }
+
+  heap_stats_t stats;
+  for (uint i = 0; i < g_arena_count; ++i)
+  {
+    if (!arena_stats(i, &stats))
+    {
+      continue;
+    }
+    info.arena += stats.heap_bytes;
+    info.ordblks += stats.free_chunks;
+    info.uordblks += stats.live_bytes;
+    info.fordblks += stats.free_bytes;
+    info.keepcost += stats.wilderness;
+    if (i == 0)
+    {
+      info.hblks = stats.counters.mmaps - stats.counters.munmaps;
+      info.hblkhd = stats.counters.mmapped;
+    }
+  }
+  return info;
 }
@@ -0,0 +1,448 @@
+// allocation microbenchmarks, run against the system malloc and against any
+// malloc that can be preloaded, such as libmyalloc.so or jemalloc.
+//
+//   bench [-n ops] [-t threads] [-w window] [-c case] [allocator...]
+//
+// an allocator is "system" or the path of a shared library to preload, the
+// default is "system ./libmyalloc.so". paths that do not exist are skipped,
+// so candidates that may not be installed can be listed too.
+//
+// every case is one alloc/free pattern over one size distribution:
+//
+//   lifo      allocate window objects, free them newest first
+//   fifo      keep window objects, always free the oldest one
+//   random    keep window objects, free a random one
+//   prodcons  threads in pairs, one allocates and hands the objects over
+//             through a ring, the other frees them
+//   realloc   grow a block from 16 bytes to 1MB by half of its size at a time
+//
+//   fixed     64 bytes
+//   uniform   16 to 4096 bytes
+//   power     16 to 64K bytes, the chance of a size falls with its square
+//
+// -c keeps the cases whose name contains the given string. each case runs
+// with 1, 2, 4, ... up to -t threads (the number of CPUs by default), every
+// thread doing -n timed calls, in a fresh process per allocator. a row
+// reports calls per second of wall time across all threads, the p50, p99
+// and p99.9 latency of a single call in ns, and the peak RSS the run added.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_OPS 1000000
+#define BENCH_WINDOW 4096
+#define RING_SIZE 1024 // slots per producer/consumer pair
+#define REALLOC_MAX (1 << 20)
+
+enum { PAT_LIFO, PAT_FIFO, PAT_RANDOM, PAT_PRODCONS, PAT_REALLOC, PAT_COUNT };
+enum { DIST_FIXED, DIST_UNIFORM, DIST_POWER, DIST_COUNT };
+
+static const char *patterns[] = { "lifo", "fifo", "random", "prodcons", "realloc" };
+static const char *dists[] = { "fixed", "uniform", "power" };
+
+// a single-producer single-consumer ring of pointers
+typedef struct {
+    void *slots[RING_SIZE];
+    uint64_t head __attribute__((aligned(64))); // next slot to write
+    uint64_t tail __attribute__((aligned(64))); // next slot to read
+} ring_t;
+
+typedef struct {
+    pthread_t thread;
+    uint32_t index;
+    uint64_t rng;
+    uint32_t *lat;   // one per timed call, in ticks
+    size_t count;    // timed calls so far
+    void **window;
+    ring_t *ring;    // prodcons only, shared with the partner
+} worker_t;
+
+static int g_pattern;
+static int g_dist;
+static size_t g_ops = BENCH_OPS;
+static size_t g_window = BENCH_WINDOW;
+static pthread_barrier_t g_start;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the time stamp counter is far cheaper to read than the clock, so single
+// calls are timed with it where there is one
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static double ns_per_tick(void) {
+    uint64_t t0 = now_ns(), c0 = ticks();
+    usleep(20000);
+    uint64_t t1 = now_ns(), c1 = ticks();
+    return c1 > c0 ? (double) (t1 - t0) / (c1 - c0) : 1.0;
+}
+
+// xorshift64, good enough to pick sizes and slots
+static uint64_t next_rand(worker_t *w) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return w->rng;
+}
+
+static size_t next_size(worker_t *w) {
+    switch (g_dist) {
+    case DIST_UNIFORM:
+        return 16 + next_rand(w) % (4096 - 16 + 1);
+    case DIST_POWER: {
+        // inverse of the distribution function of a density ~ 1/s^2
+        double u = (next_rand(w) >> 11) * (1.0 / (1ULL << 53));
+        return (size_t) (16 / (1 - u * (1 - 16.0 / 65536)));
+    }
+    default:
+        return 64;
+    }
+}
+
+// bookkeeping memory comes straight from the kernel and is touched up
+// front, so it neither goes through the allocator under test nor adds to
+// the RSS the run is charged with
+static void *raw_alloc(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+// write the start of the object the way a constructor would
+static inline void touch(void *p, size_t size) {
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(p, 0xa5, size < 64 ? size : 64);
+}
+
+static inline void *timed_alloc(worker_t *w, size_t size) {
+    uint64_t t0 = ticks();
+    void *p = malloc(size);
+    uint64_t t1 = ticks();
+    w->lat[w->count++] = t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0;
+    touch(p, size);
+    return p;
+}
+
+static inline void timed_free(worker_t *w, void *p) {
+    uint64_t t0 = ticks();
+    free(p);
+    uint64_t t1 = ticks();
+    w->lat[w->count++] = t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0;
+}
+
+static void run_lifo(worker_t *w) {
+    while (w->count + 2 * g_window <= g_ops) {
+        for (size_t i = 0; i < g_window; i++)
+            w->window[i] = timed_alloc(w, next_size(w));
+        for (size_t i = g_window; i-- > 0;)
+            timed_free(w, w->window[i]);
+    }
+}
+
+// fifo and random share the steady state: a full window where every free
+// is followed by an allocation in the same slot
+static void run_window(worker_t *w) {
+    for (size_t i = 0; i < g_window; i++) {
+        size_t size = next_size(w);
+        w->window[i] = malloc(size);
+        touch(w->window[i], size);
+    }
+
+    size_t slot = 0;
+    while (w->count + 2 <= g_ops) {
+        slot = g_pattern == PAT_FIFO ? (slot + 1) % g_window : next_rand(w) % g_window;
+        timed_free(w, w->window[slot]);
+        w->window[slot] = timed_alloc(w, next_size(w));
+    }
+
+    for (size_t i = 0; i < g_window; i++)
+        free(w->window[i]);
+}
+
+static void run_producer(worker_t *w) {
+    ring_t *r = w->ring;
+    while (w->count < g_ops) {
+        void *p = timed_alloc(w, next_size(w));
+        while (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+            sched_yield();
+        r->slots[r->head % RING_SIZE] = p;
+        __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void run_consumer(worker_t *w) {
+    ring_t *r = w->ring;
+    while (w->count < g_ops) {
+        while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail)
+            sched_yield();
+        void *p = r->slots[r->tail % RING_SIZE];
+        __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+        timed_free(w, p);
+    }
+}
+
+static void run_realloc(worker_t *w) {
+    while (w->count + 2 <= g_ops) {
+        size_t size = 16;
+        char *p = timed_alloc(w, size);
+        while (size < REALLOC_MAX && w->count + 2 <= g_ops) {
+            size += size / 2;
+            uint64_t t0 = ticks();
+            p = realloc(p, size);
+            uint64_t t1 = ticks();
+            w->lat[w->count++] = t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0;
+            if (p == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            p[size - 1] = 1; // the grown part is written too
+        }
+        timed_free(w, p);
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pthread_barrier_wait(&g_start);
+
+    switch (g_pattern) {
+    case PAT_LIFO:
+        run_lifo(w);
+        break;
+    case PAT_FIFO:
+    case PAT_RANDOM:
+        run_window(w);
+        break;
+    case PAT_PRODCONS:
+        if (w->index % 2 == 0)
+            run_producer(w);
+        else
+            run_consumer(w);
+        break;
+    case PAT_REALLOC:
+        run_realloc(w);
+        break;
+    }
+
+    pthread_barrier_wait(&g_start);
+    return NULL;
+}
+
+static long status_kb(const char *field) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return 0;
+
+    char line[256];
+    long kb = 0;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, len) == 0) {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+static void case_name(int c, char *name, size_t len) {
+    if (c / DIST_COUNT == PAT_REALLOC)
+        snprintf(name, len, "%s", patterns[PAT_REALLOC]);
+    else
+        snprintf(name, len, "%s/%s", patterns[c / DIST_COUNT], dists[c % DIST_COUNT]);
+}
+
+static int by_value(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// run case c with the given number of threads in this process and print
+// its row
+static void run_case(int c, uint32_t threads, const char *label) {
+    g_pattern = c / DIST_COUNT;
+    g_dist = c % DIST_COUNT;
+
+    double scale = ns_per_tick();
+    worker_t *workers = raw_alloc(threads * sizeof(worker_t));
+    uint32_t *lat = raw_alloc(threads * g_ops * sizeof(uint32_t));
+    for (uint32_t i = 0; i < threads; i++) {
+        worker_t *w = &workers[i];
+        w->index = i;
+        w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        w->lat = lat + i * g_ops;
+        w->window = raw_alloc(g_window * sizeof(void *));
+        if (g_pattern == PAT_PRODCONS && i % 2 == 0)
+            w->ring = raw_alloc(sizeof(ring_t));
+        else if (g_pattern == PAT_PRODCONS)
+            w->ring = workers[i - 1].ring;
+    }
+
+    pthread_barrier_init(&g_start, NULL, threads + 1);
+    for (uint32_t i = 0; i < threads; i++)
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+
+    long base_kb = status_kb("VmRSS:");
+    pthread_barrier_wait(&g_start);
+    uint64_t t0 = now_ns();
+    pthread_barrier_wait(&g_start);
+    uint64_t t1 = now_ns();
+    long peak_kb = status_kb("VmHWM:") - base_kb;
+
+    for (uint32_t i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    // the workers' latencies are packed together before they are sorted
+    size_t n = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        memmove(lat + n, workers[i].lat, workers[i].count * sizeof(uint32_t));
+        n += workers[i].count;
+    }
+    qsort(lat, n, sizeof(uint32_t), by_value);
+    if (n == 0)
+        lat[n++] = 0;
+
+    char name[32];
+    case_name(c, name, sizeof(name));
+    printf("%-18s %-10s %7u %12.0f %7.0f %7.0f %8.0f %9.1f\n", name, label, threads,
+           t1 > t0 ? n * 1e9 / (t1 - t0) : 0.0,
+           lat[n / 2] * scale, lat[n * 99 / 100] * scale, lat[n * 999 / 1000] * scale,
+           peak_kb / 1024.0);
+    fflush(stdout);
+}
+
+// libjemalloc.so.2 -> jemalloc
+static void label_of(const char *alloc, char *label, size_t len) {
+    const char *base = strrchr(alloc, '/');
+    base = base ? base + 1 : alloc;
+    if (strncmp(base, "lib", 3) == 0)
+        base += 3;
+    snprintf(label, len, "%.*s", (int) strcspn(base, "."), base);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = "";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max_threads = cpus < 1 ? 1 : (uint32_t) cpus;
+    int child = -1;
+    const char *label = "";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:w:c:x:L:")) != -1) {
+        switch (opt) {
+        case 'n':
+            g_ops = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            max_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            g_window = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            filter = optarg;
+            break;
+        case 'x': // a single run, started by the parent below
+            child = atoi(optarg);
+            break;
+        case 'L':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n ops] [-t threads] [-w window] [-c case] [allocator...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (g_ops < 2 || g_window == 0 || max_threads == 0) {
+        fprintf(stderr, "%s: -n must be at least 2, -t and -w at least 1\n", argv[0]);
+        return 2;
+    }
+
+    if (child >= 0) {
+        run_case(child, max_threads, label);
+        return 0;
+    }
+
+    static char *defaults[] = { "system", "./libmyalloc.so" };
+    char **allocs = optind < argc ? argv + optind : defaults;
+    int nallocs = optind < argc ? argc - optind : 2;
+
+    printf("%-18s %-10s %7s %12s %7s %7s %8s %9s\n",
+           "case", "allocator", "threads", "ops/sec", "p50", "p99", "p99.9", "peak MB");
+    fflush(stdout);
+
+    int cases = (PAT_COUNT - 1) * DIST_COUNT + 1; // realloc has no distribution
+    for (int c = 0; c < cases; c++) {
+        char name[32];
+        case_name(c, name, sizeof(name));
+        if (strstr(name, filter) == NULL)
+            continue;
+
+        // producers and consumers come in pairs
+        int pairs = c / DIST_COUNT == PAT_PRODCONS;
+        for (uint32_t t = pairs ? 2 : 1; t <= (pairs && max_threads < 2 ? 2 : max_threads); t *= 2) {
+            for (int a = 0; a < nallocs; a++) {
+                int system = strcmp(allocs[a], "system") == 0;
+                if (!system && access(allocs[a], R_OK) != 0)
+                    continue;
+
+                char label_buf[32], case_buf[16], threads_buf[16], ops_buf[32], window_buf[32];
+                label_of(allocs[a], label_buf, sizeof(label_buf));
+                snprintf(case_buf, sizeof(case_buf), "%d", c);
+                snprintf(threads_buf, sizeof(threads_buf), "%u", t);
+                snprintf(ops_buf, sizeof(ops_buf), "%zu", g_ops);
+                snprintf(window_buf, sizeof(window_buf), "%zu", g_window);
+
+                // a process of its own, so each run starts from a fresh
+                // allocator and its peak RSS is its alone
+                pid_t pid = fork();
+                if (pid == 0) {
+                    if (system)
+                        unsetenv("LD_PRELOAD");
+                    else
+                        setenv("LD_PRELOAD", allocs[a], 1);
+                    execl("/proc/self/exe", argv[0], "-x", case_buf, "-t", threads_buf, "-n", ops_buf,
+                          "-w", window_buf, "-L", label_buf, (char *) NULL);
+                    perror("exec");
+                    _exit(1);
+                }
+
+                int status;
+                waitpid(pid, &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    fprintf(stderr, "%s: %s failed with %s\n", name, label_buf, allocs[a]);
+            }
+        }
+    }
+    return 0;
+}
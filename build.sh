@@ -5,10 +5,15 @@ set -ex
 rm -rf *.o *.so *.elf
 
 
-gcc -shared -fPIC alloc-override.c heap.c llist.c -o libmyalloc.so
+gcc -shared -fPIC alloc-override.c heap.c llist.c slab.c trace.c new-override.cpp -lstdc++ -lpthread -o libmyalloc.so
 
 gcc -g -ggdb -O0 -o test.c.o -c test.c
 gcc -o test.elf test.c.o -L./ -lmyalloc -Wl,-rpath=./
 
 ldd test.elf
 ./test.elf
+
+gcc -g -ggdb -O0 -o test_mt.c.o -c test_mt.c
+gcc -o test_mt.elf test_mt.c.o -L./ -lmyalloc -lpthread -Wl,-rpath=./
+
+./test_mt.elf
@@ -1,99 +1,799 @@
+#define _GNU_SOURCE // mremap
 #include "include/heap.h"
 #include "include/llist.h"
+#include "include/slab.h"
 
-uint offset = 8;
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+uint offset = offsetof(node_t, next);
+
+static size_t page_round(size_t sz) {
+    return (sz + HEAP_PAGE_SIZE - 1) & ~((size_t) HEAP_PAGE_SIZE - 1);
+}
+
+// round a request up to a chunk size that keeps the whole chunk a multiple
+// of HEAP_ALIGN, so the next header stays aligned too
+static size_t align_size(size_t size) {
+    size_t total = (size + overhead + HEAP_ALIGN - 1) & ~((size_t) HEAP_ALIGN - 1);
+    return total - overhead;
+}
+
+// the most the heap can ever hold, requests above it cannot fit
+static size_t heap_span(heap_t *heap) {
+    return (heap->limit ? heap->limit : heap->end) - heap->start;
+}
+
+static uint fls_sizet(size_t sz) {
+    return (sizeof(size_t) * 8 - 1) - __builtin_clzl(sz);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a free chunk that can be purged keeps the time it was freed right after
+// its header. the pages purged are the whole heap pages after that.
+static uint64_t *purge_stamp(node_t *node) {
+    return (uint64_t *) (node + 1);
+}
+
+static char *purge_start(heap_t *heap, node_t *node) {
+    uintptr_t p = (uintptr_t) (purge_stamp(node) + 1);
+    return (char *) ((p + heap->page - 1) & ~(uintptr_t) (heap->page - 1));
+}
+
+static char *purge_end(heap_t *heap, node_t *node) {
+    return (char *) ((uintptr_t) get_foot(node) & ~(uintptr_t) (heap->page - 1));
+}
+
+// whether a free chunk is waiting to be purged, and so carries a stamp
+static uint purgeable(heap_t *heap, node_t *node) {
+    return heap->purge_min != 0 && node->size >= heap->purge_min && !(node->flags & CHUNK_PURGED);
+}
+
+// stamp a free chunk that can be purged with the time it was freed, now
+// or the time from's memory was. a stamp above heap->zero would dirty fresh
+// memory: it reads as zero there, so the chunk counts as freed long ago,
+// which costs nothing as none of its pages are in use yet.
+static void stamp_free(heap_t *heap, node_t *node, node_t *from) {
+    if (!purgeable(heap, node) || (long) purge_stamp(node) >= heap->zero)
+        return;
+    *purge_stamp(node) = from != NULL ? *purge_stamp(from) : now_ms();
+}
+
+static void insert_free(heap_t *heap, node_t *node) {
+    uint index = get_bin_index(node->size);
+    uint fl = index / SL_INDEX_COUNT;
+
+    // the size classes already give a good fit, so bins need not be sorted
+    switch (heap->opts.insert) {
+    case HEAP_INSERT_SORTED: add_node(heap->bins[index], node); break;
+    case HEAP_INSERT_ADDR:   add_node_addr(heap->bins[index], node); break;
+    default:                 add_node_lifo(heap->bins[index], node); break;
+    }
+    heap->fl_bitmap |= 1U << fl;
+    heap->sl_bitmap[fl] |= 1U << (index % SL_INDEX_COUNT);
+}
+
+// must be called before node->size is changed
+static void remove_free(heap_t *heap, node_t *node) {
+    uint index = get_bin_index(node->size);
+    uint fl = index / SL_INDEX_COUNT;
+    bin_t *bin = heap->bins[index];
+
+    remove_node(bin, node);
+    if (bin->head == NULL) {
+        heap->sl_bitmap[fl] &= ~(1U << (index % SL_INDEX_COUNT));
+        if (heap->sl_bitmap[fl] == 0)
+            heap->fl_bitmap &= ~(1U << fl);
+    }
+}
+
+// first non-empty bin at or above index, or BIN_COUNT if there is none
+static uint find_bin(heap_t *heap, uint index) {
+    // get_fit_index gives BIN_COUNT for sizes no bin can hold
+    if (index >= BIN_COUNT)
+        return BIN_COUNT;
+
+    uint fl = index / SL_INDEX_COUNT;
+    uint sl_map = heap->sl_bitmap[fl] & (~0U << (index % SL_INDEX_COUNT));
+
+    if (sl_map == 0) {
+        uint fl_map = heap->fl_bitmap & (~0U << (fl + 1));
+        if (fl_map == 0)
+            return BIN_COUNT;
+
+        fl = __builtin_ctz(fl_map);
+        sl_map = heap->sl_bitmap[fl];
+    }
+    return fl * SL_INDEX_COUNT + __builtin_ctz(sl_map);
+}
+
+static void init_region(heap_t *heap, long start, size_t size, long limit) {
+    // every header, and so every user pointer, is HEAP_ALIGN aligned
+    long aligned = (start + HEAP_ALIGN - 1) & ~(long) (HEAP_ALIGN - 1);
+    size = (size - (aligned - start)) & ~((size_t) HEAP_ALIGN - 1);
+    start = aligned;
 
-void init_heap(heap_t *heap, long start) {
     node_t *init_region = (node_t *) start;
     init_region->hole = 1;
-    init_region->size = (HEAP_INIT_SIZE) - sizeof(node_t) - sizeof(footer_t);
+    init_region->flags = 0;
+    init_region->size = size - sizeof(node_t) - sizeof(footer_t);
 
     create_foot(init_region);
 
-    add_node(heap->bins[get_bin_index(init_region->size)], init_region);
+    heap->fl_bitmap = 0;
+    for (uint i = 0; i < FL_INDEX_COUNT; i++)
+        heap->sl_bitmap[i] = 0;
 
-    heap->start = (void *) start;
-    heap->end   = (void *) (start + HEAP_INIT_SIZE);
+    heap->start = start;
+    heap->end   = start + size;
+    heap->limit = limit;
+    heap->page  = limit != 0 && heap->opts.huge != HEAP_HUGE_OFF ? HEAP_HUGE_PAGE_SIZE : HEAP_PAGE_SIZE;
+
+    if (heap->opts.mmap_threshold == 0)
+        heap->opts.mmap_threshold = HEAP_MMAP_THRESHOLD;
+
+    heap->remote = NULL;
+    memset(&heap->counters, 0, sizeof(heap->counters));
+
+    heap->quick_max = heap->opts.quick_limit < QUICK_MAX_SZ ? heap->opts.quick_limit : QUICK_MAX_SZ;
+    heap->quick_count = 0;
+    for (uint i = 0; i < QUICK_COUNT; i++)
+        heap->quick[i] = NULL;
+
+    // fresh pages read as zero, memory from the caller might not
+    heap->zero = limit != 0 ? start + (long) sizeof(node_t) : heap->end;
+
+    heap->purge_min = heap->opts.purge_limit;
+    if (heap->purge_min != 0 && heap->purge_min < PURGE_MIN_SZ)
+        heap->purge_min = PURGE_MIN_SZ;
+    heap->purge_tick = 0;
+    heap->clean = NULL;
+
+    insert_free(heap, init_region);
+
+    heap->slab_max = 0;
+    heap->slab_map = NULL;
+    for (uint i = 0; i < SLAB_CLASSES; i++)
+        heap->slabs[i] = NULL;
+
+    if (heap->opts.slab_limit != HEAP_SLAB_OFF)
+        slab_init(heap, heap->opts.slab_limit ? heap->opts.slab_limit : SLAB_MAX_SZ);
 }
 
-void *heap_alloc(heap_t *heap, size_t size) {
-    uint index = get_bin_index(size);
-    bin_t *temp = (bin_t *) heap->bins[index];
-    node_t *found = get_best_fit(temp, size);
+void init_heap(heap_t *heap, long start) {
+    init_region(heap, start, HEAP_INIT_SIZE, 0); // a fixed region cannot grow
+}
 
-    while (found == NULL) {
-        if (index + 1 >= BIN_COUNT)
-            return NULL;
+static uint map_region(heap_t *heap, void *base, size_t reserve) {
+    size_t size = HEAP_MIN_SIZE;
 
-        temp = heap->bins[++index];
-        found = get_best_fit(temp, size);
+    if (heap->opts.huge != HEAP_HUGE_OFF) {
+        size = HEAP_HUGE_PAGE_SIZE;
+        // the hint only sticks to the reservation, so give it before the
+        // first pages are made accessible and split it off
+        if (heap->opts.huge == HEAP_HUGE_THP)
+            madvise(base, reserve, MADV_HUGEPAGE);
     }
 
-    if ((found->size - size) > (overhead + MIN_ALLOC_SZ)) {
-        node_t *split = (node_t *) (((char *) found + sizeof(node_t) + sizeof(footer_t)) + size);
-        split->size = found->size - size - sizeof(node_t) - sizeof(footer_t);
-        split->hole = 1;
-   
-        create_foot(split);
+    if (mprotect(base, size, PROT_READ | PROT_WRITE) != 0)
+        return 0;
 
-        uint new_idx = get_bin_index(split->size);
+    init_region(heap, (long) base, size, (long) base + reserve);
+    return 1;
+}
 
-        add_node(heap->bins[new_idx], split); 
+uint map_heap(heap_t *heap, size_t reserve) {
+    void *base = MAP_FAILED;
 
-        found->size = size; 
-        create_foot(found); 
+    if (heap->opts.huge != HEAP_HUGE_OFF)
+        reserve = (reserve + HEAP_HUGE_PAGE_SIZE - 1) & ~((size_t) HEAP_HUGE_PAGE_SIZE - 1);
+
+    // 2MB hugetlbfs pages (log2 in the MAP_HUGE_SHIFT bits) are taken from
+    // the pool for the whole reservation now, so touching them later cannot
+    // fail. when the pool is too small fall back to transparent huge pages.
+    if (heap->opts.huge == HEAP_HUGE_TLB) {
+        base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        if (base == MAP_FAILED)
+            heap->opts.huge = HEAP_HUGE_THP;
     }
 
-    found->hole = 0; 
-    remove_node(heap->bins[index], found); 
-    
+    if (base == MAP_FAILED) {
+        // only reserve address space here, pages are mapped in by expand.
+        // huge pages need the heap to start on a huge page boundary, so
+        // reserve one more and trim the ends.
+        size_t slack = heap->opts.huge != HEAP_HUGE_OFF ? HEAP_HUGE_PAGE_SIZE : 0;
+        char *raw = mmap(NULL, reserve + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED)
+            return 0;
+
+        base = raw;
+        if (slack != 0) {
+            base = (void *) (((uintptr_t) raw + slack - 1) & ~((uintptr_t) slack - 1));
+            if ((char *) base != raw)
+                munmap(raw, (char *) base - raw);
+            munmap((char *) base + reserve, raw + slack - (char *) base);
+        }
+    }
+
+    if (!map_region(heap, base, reserve)) {
+        munmap(base, reserve);
+        return 0;
+    }
+    return 1;
+}
+
+// set up a heap in address space the caller has already reserved PROT_NONE.
+// it is not hugetlbfs memory, so HEAP_HUGE_TLB gets transparent huge pages.
+uint map_heap_at(heap_t *heap, void *base, size_t reserve) {
+    if (heap->opts.huge == HEAP_HUGE_TLB)
+        heap->opts.huge = HEAP_HUGE_THP;
+    return map_region(heap, base, reserve);
+}
+
+void unmap_heap(heap_t *heap) {
+    if (heap->limit != 0)
+        munmap((void *) heap->start, heap->limit - heap->start);
+}
+
+// the non-empty bin after index, or BIN_COUNT
+static uint next_bin(heap_t *heap, uint index) {
+    return index + 1 < BIN_COUNT ? find_bin(heap, index + 1) : BIN_COUNT;
+}
+
+// good fit: every chunk in the fit class and above is big enough, so a bin
+// head will do. of the exact class only the head is looked at, so no bin is
+// ever walked. the wilderness is only cut into if nothing else fits, since
+// every cut leaves the heap a little bigger.
+static node_t *find_good(heap_t *heap, size_t size) {
     node_t *wild = get_wilderness(heap);
-    if (wild->size < MIN_WILDERNESS) {
-        uint success = expand(heap, 0x1000);
-        if (success == 0) {
-            return NULL;
+
+    for (uint i = find_bin(heap, get_fit_index(size)); i < BIN_COUNT; i = next_bin(heap, i)) {
+        node_t *node = heap->bins[i]->head;
+        if (node == wild)
+            node = node->next;
+        if (node != NULL)
+            return node;
+    }
+
+    node_t *node = heap->bins[get_bin_index(size)]->head;
+    if (node == wild)
+        node = node->next;
+    if (node != NULL && node->size >= size)
+        return node;
+
+    return wild->hole && wild->size >= size ? wild : NULL;
+}
+
+// best fit: the smallest chunk that is big enough. bins are ordered by
+// size, so it is in the first bin that has a chunk big enough at all.
+static node_t *find_best(heap_t *heap, size_t size) {
+    for (uint i = find_bin(heap, get_bin_index(size)); i < BIN_COUNT; i = next_bin(heap, i)) {
+        node_t *best = NULL;
+        for (node_t *node = heap->bins[i]->head; node != NULL; node = node->next) {
+            if (node->size >= size && (best == NULL || node->size < best->size))
+                best = node;
+        }
+        if (best != NULL)
+            return best;
+    }
+    return NULL;
+}
+
+// address-ordered first fit: the lowest chunk that is big enough, which
+// keeps allocations packed at the bottom of the heap. with HEAP_INSERT_ADDR
+// the first fit in a bin is its lowest, otherwise each bin is searched.
+static node_t *find_first(heap_t *heap, size_t size) {
+    node_t *first = NULL;
+
+    for (uint i = find_bin(heap, get_bin_index(size)); i < BIN_COUNT; i = next_bin(heap, i)) {
+        for (node_t *node = heap->bins[i]->head; node != NULL; node = node->next) {
+            if (first != NULL && node > first) {
+                if (heap->opts.insert == HEAP_INSERT_ADDR)
+                    break;
+                continue;
+            }
+            if (node->size >= size) {
+                first = node;
+                if (heap->opts.insert == HEAP_INSERT_ADDR)
+                    break;
+            }
         }
     }
-    else if (wild->size > MAX_WILDERNESS) {
-        contract(heap, 0x1000);
+    return first;
+}
+
+static node_t *find_fit(heap_t *heap, size_t size) {
+    switch (heap->opts.fit) {
+    case HEAP_FIT_BEST:  return find_best(heap, size);
+    case HEAP_FIT_FIRST: return find_first(heap, size);
+    default:             return find_good(heap, size);
+    }
+}
+
+// the chunk physically after node, or NULL if node is the last one
+static node_t *next_chunk(heap_t *heap, node_t *node) {
+    node_t *next = (node_t *) ((char *) get_foot(node) + sizeof(footer_t));
+    return next == (node_t *) (uintptr_t) heap->end ? NULL : next;
+}
+
+// cut node down to size bytes and free the rest if it is big enough to be
+// a chunk of its own. the rest is merged with the next chunk if that is free,
+// which can only happen when a chunk in use is shrunk. the rest of a purged
+// chunk stays purged.
+static void split_chunk(heap_t *heap, node_t *node, size_t size) {
+    if ((node->size - size) <= (overhead + MIN_ALLOC_SZ))
+        return;
+
+    node_t *split = (node_t *) (((char *) node + sizeof(node_t) + sizeof(footer_t)) + size);
+    split->size = node->size - size - sizeof(node_t) - sizeof(footer_t);
+    split->hole = 1;
+    split->flags = node->flags & CHUNK_PURGED;
+    heap->counters.splits++;
+
+    node->size = size;
+    create_foot(node);
+
+    // the rest of a free chunk was freed when the chunk was. a merged
+    // chunk keeps the stamp of its biggest part, see free_chunk
+    node_t *from = node->hole ? node : NULL;
+    node_t *next = next_chunk(heap, split);
+    if (next != NULL && next->hole) {
+        from = next->size > split->size && purgeable(heap, next) ? next : NULL;
+        remove_free(heap, next);
+        split->size += overhead + next->size;
+        split->flags = 0;
+        heap->counters.coalesces++;
+    }
+
+    create_foot(split);
+    stamp_free(heap, split, from);
+    insert_free(heap, split);
+}
+
+// huge chunks get a mapping of their own so they never fragment the heap.
+// they have a header but no footer and are never binned or coalesced.
+static void *huge_alloc(heap_t *heap, size_t size) {
+    if (size > SIZE_MAX - sizeof(node_t) - HEAP_PAGE_SIZE)
+        return NULL;
+
+    size_t len = page_round(sizeof(node_t) + size);
+    node_t *node = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (node == MAP_FAILED)
+        return NULL;
+
+    node->hole = 0;
+    node->flags = CHUNK_MMAPPED;
+    node->size = len - sizeof(node_t);
+
+    // mapped chunks are allocated and freed without the heap's lock
+    __atomic_add_fetch(&heap->counters.mmaps, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap->counters.mmapped, len, __ATOMIC_RELAXED);
+    return &node->next;
+}
+
+static void flush_quick(heap_t *heap);
+
+// find a free chunk of at least size bytes, growing the heap if needed,
+// and take it out of its bin
+static node_t *take_fit(heap_t *heap, size_t size) {
+    if (size > heap_span(heap))
+        return NULL;
+
+    // purging is paid for by the allocations that search the bins
+    if (heap->purge_min != 0 && ++heap->purge_tick >= PURGE_INTERVAL)
+        heap_purge(heap);
+
+    node_t *found = find_fit(heap, size);
+
+    // merging the deferred chunks may make room without growing the heap
+    if (found == NULL && heap->quick_count > 0) {
+        flush_quick(heap);
+        found = find_fit(heap, size);
+    }
+
+    if (found == NULL) {
+        // grow the wilderness so it can hold the request and try again
+        if (!expand(heap, size + overhead + HEAP_MIN_SIZE))
+            return NULL;
+
+        found = find_fit(heap, size);
+        if (found == NULL)
+            return NULL;
     }
 
+    remove_free(heap, found);
+    return found;
+}
+
+// everything from heap->zero up has not been handed out since it was
+// mapped, so it still reads as zero. the header that a split writes after
+// the chunk is covered too.
+static void mark_dirty(heap_t *heap, node_t *node) {
+    long end = (long) get_foot(node) + sizeof(footer_t) + sizeof(node_t);
+    if (end > heap->zero)
+        heap->zero = end;
+}
+
+static void *use_chunk(heap_t *heap, node_t *found) {
+    found->hole = 0; 
+    mark_dirty(heap, found);
+
+    // chunks in use are never marked purged, heap_calloc asks here instead.
+    // purged memory from the caller of init_heap need not read as zero
+    uint clean = found->flags & CHUNK_PURGED && !heap->opts.purge_lazy && heap->limit != 0;
+    heap->clean = clean ? found : NULL;
+    found->flags &= ~CHUNK_PURGED;
+    heap->counters.allocs++;
+
     found->prev = NULL;
     found->next = NULL;
     return &found->next; 
 }
 
+static void drain_remote(heap_t *heap);
+
+void *heap_alloc(heap_t *heap, size_t size) {
+    // mapped chunks never touch the heap, callers need not hold it for them
+    if (size >= heap->opts.mmap_threshold)
+        return huge_alloc(heap, size);
+
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    if (size != 0 && size <= heap->slab_max)
+        return slab_alloc(heap, size);
+
+    if (size > heap_span(heap))
+        return NULL;
+
+    size = align_size(size);
+
+    // a chunk of exactly this size was freed lately, reuse it as it is
+    if (size <= heap->quick_max && heap->quick[size / HEAP_ALIGN] != NULL) {
+        node_t *node = heap->quick[size / HEAP_ALIGN];
+        heap->quick[size / HEAP_ALIGN] = node->next;
+        heap->quick_count--;
+        heap->counters.allocs++;
+        node->next = NULL;
+        return &node->next;
+    }
+
+    node_t *found = take_fit(heap, size);
+    if (found == NULL)
+        return NULL;
+
+    split_chunk(heap, found, size);
+    return use_chunk(heap, found);
+}
+
+// allocate size bytes at a multiple of align (a power of two) from the
+// heap itself. the slack in front of the aligned chunk is split off as a
+// free chunk, so it is never wasted.
+void *heap_alloc_aligned(heap_t *heap, size_t align, size_t size) {
+    // every allocation is aligned this much already
+    if (align <= HEAP_ALIGN)
+        return heap_alloc(heap, size);
+
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    // the worst case gap in front has to fit a chunk of its own
+    size_t pad = align + overhead + MIN_ALLOC_SZ;
+    if (size > heap_span(heap) || align > heap_span(heap))
+        return NULL;
+
+    size = align_size(size);
+
+    node_t *found = take_fit(heap, size + pad);
+    if (found == NULL)
+        return NULL;
+
+    uintptr_t user = (uintptr_t) &found->next;
+    uintptr_t aligned = (user + align - 1) & ~(uintptr_t) (align - 1);
+    if (aligned != user) {
+        while (aligned - user <= overhead + MIN_ALLOC_SZ)
+            aligned += align;
+
+        // found keeps the gap and goes back into the bins, node takes the rest
+        node_t *node = (node_t *) (aligned - offset);
+        node->hole = 0;
+        node->flags = 0;
+        node->size = found->size - (aligned - user);
+        create_foot(node);
+
+        found->size = aligned - user - overhead;
+        create_foot(found);
+        insert_free(heap, found);
+
+        found = node;
+    }
+
+    split_chunk(heap, found, size);
+    return use_chunk(heap, found);
+}
+
+// cut up to n chunks of size bytes from the front of region, which is out
+// of the bins, and hand out their pointers. what is left over is split off
+// as usual. returns the number of chunks cut.
+static size_t carve_chunks(heap_t *heap, node_t *region, size_t size, size_t n, void **out) {
+    size_t stride = size + overhead;
+    size_t total = region->size;
+    size_t i;
+
+    for (i = 0; i + 1 < n && total >= stride + size; i++) {
+        region->hole = 0;
+        region->flags = 0;
+        region->size = size;
+        region->next = NULL;
+        region->prev = NULL;
+        create_foot(region);
+        out[i] = &region->next;
+        heap->counters.allocs++;
+
+        total -= stride;
+        region = (node_t *) ((char *) region + stride);
+    }
+
+    // the last one takes the rest of the region and gives back what it can
+    region->hole = 0;
+    region->flags = 0;
+    region->size = total;
+    create_foot(region);
+    split_chunk(heap, region, size);
+    out[i] = use_chunk(heap, region);
+    return i + 1;
+}
+
+// allocate n chunks of size bytes into out. the chunks are cut from one
+// free region at a time instead of searching the bins for every one.
+// returns how many were allocated, which is less than n only if the heap
+// runs out of memory.
+size_t heap_alloc_batch(heap_t *heap, size_t size, size_t n, void **out) {
+    size_t done = 0;
+
+    // slab objects and mapped chunks do not come from a region
+    if ((size != 0 && size <= heap->slab_max) || size >= heap->opts.mmap_threshold) {
+        while (done < n && (out[done] = heap_alloc(heap, size)) != NULL)
+            done++;
+        return done;
+    }
+
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    if (size > heap_span(heap))
+        return 0;
+
+    size = align_size(size);
+    size_t stride = size + overhead;
+
+    while (done < n) {
+        // ask for room for all that is left, and for less if that fails
+        size_t want = n - done;
+        if (want > heap_span(heap) / stride)
+            want = heap_span(heap) / stride;
+
+        node_t *region = NULL;
+        while (want > 0 && (region = take_fit(heap, want * stride - overhead)) == NULL)
+            want /= 2;
+        if (region == NULL)
+            break;
+
+        done += carve_chunks(heap, region, size, n - done, out + done);
+    }
+    return done;
+}
+
+static int by_address(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) *(void * const *) a;
+    uintptr_t y = (uintptr_t) *(void * const *) b;
+    return x < y ? -1 : x > y;
+}
+
+// free n pointers at once. ptrs is sorted by address in place, so that
+// each run of chunks that sit next to each other is joined and freed (and
+// coalesced with its neighbours) in one go. NULL entries are skipped.
+void heap_free_batch(heap_t *heap, void **ptrs, size_t n) {
+    // pointers often come back in the order they were handed out
+    for (size_t i = 1; i < n; i++) {
+        if ((uintptr_t) ptrs[i - 1] > (uintptr_t) ptrs[i]) {
+            qsort(ptrs, n, sizeof(void *), by_address);
+            break;
+        }
+    }
+
+    size_t i = 0;
+    while (i < n) {
+        void *p = ptrs[i++];
+        if (p == NULL)
+            continue;
+
+        node_t *head = (node_t *) ((char *) p - offset);
+        if (slab_owns(heap, p) || head->flags & CHUNK_MMAPPED) {
+            heap_free(heap, p);
+            continue;
+        }
+
+        // swallow every following pointer whose chunk comes right after
+        node_t *last = head;
+        size_t run = 1;
+        while (i < n) {
+            node_t *next = next_chunk(heap, last);
+            if (next == NULL || ptrs[i] != &next->next || next->hole)
+                break;
+            last = next;
+            run++;
+            i++;
+        }
+
+        if (last != head) {
+            head->size = (size_t) ((char *) get_foot(last) - (char *) head) - sizeof(node_t);
+            create_foot(head);
+        }
+        heap->counters.frees += run - 1;
+        heap_free(heap, p);
+    }
+}
+
+// queue p to be freed by the next heap_alloc on this heap. this is safe
+// without holding the heap's lock: it is a single atomic push, and only
+// the first word of p is used to link the queue.
+void heap_free_remote(heap_t *heap, void *p) {
+    node_t *node = (node_t *) ((char *) p - offset);
+    node->next = __atomic_load_n(&heap->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&heap->remote, &node->next, node, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+static void release_chunk(heap_t *heap, node_t *head);
+
+// free everything queued by heap_free_remote. the whole queue is taken at
+// once, so pushes that race with this simply land on the next drain. the
+// chunks are freed like heap_free does, without draining again.
+static void drain_remote(heap_t *heap) {
+    node_t *node = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+    while (node != NULL) {
+        node_t *next = node->next;
+        if (slab_owns(heap, &node->next))
+            slab_free(heap, &node->next);
+        else if (node->flags & CHUNK_MMAPPED)
+            heap_free(heap, &node->next);
+        else
+            release_chunk(heap, node);
+        node = next;
+    }
+}
+
+static void free_chunk(heap_t *heap, node_t *head);
+
+// coalesce every chunk on the quick lists
+static void flush_quick(heap_t *heap) {
+    for (uint i = 0; i < QUICK_COUNT; i++) {
+        node_t *node = heap->quick[i];
+        while (node != NULL) {
+            node_t *next = node->next;
+            free_chunk(heap, node);
+            node = next;
+        }
+        heap->quick[i] = NULL;
+    }
+    heap->quick_count = 0;
+}
+
+// deferred coalescing: keep the chunk, still marked in use, for the next
+// request of up to size bytes, and merge it only once the lists fill up
+static void quick_push(heap_t *heap, node_t *head, size_t size) {
+    head->next = heap->quick[size / HEAP_ALIGN];
+    heap->quick[size / HEAP_ALIGN] = head;
+    if (++heap->quick_count > QUICK_FLUSH)
+        flush_quick(heap);
+}
+
 void heap_free(heap_t *heap, void *p) {
-    bin_t *list;
-    footer_t *new_foot, *old_foot;
+    if (slab_owns(heap, p)) {
+        slab_free(heap, p);
+        return;
+    }
 
     node_t *head = (node_t *) ((char *) p - offset);
-    if (head == (node_t *) (uintptr_t) heap->start) {
-        head->hole = 1; 
-        add_node(heap->bins[get_bin_index(head->size)], head);
+    if (head->flags & CHUNK_MMAPPED) {
+        __atomic_add_fetch(&heap->counters.munmaps, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&heap->counters.mmapped, sizeof(node_t) + head->size, __ATOMIC_RELAXED);
+        munmap(head, sizeof(node_t) + head->size);
         return;
     }
 
+    // the heap is held from here on, so what other threads queued for it
+    // goes back too, even if it allocates nothing more
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    release_chunk(heap, head);
+}
+
+// with the heap held: free a chunk of the heap itself
+static void release_chunk(heap_t *heap, node_t *head) {
+    heap->counters.frees++;
+
+    if (head->size <= heap->quick_max) {
+        quick_push(heap, head, head->size);
+        return;
+    }
+
+    free_chunk(heap, head);
+}
+
+// free p, which was allocated with size bytes. a chunk is at least as big
+// as align_size(size), so with deferred coalescing on, a small one goes on
+// the quick list for that size without its header being read at all.
+void heap_free_sized(heap_t *heap, void *p, size_t size) {
+    if (slab_owns(heap, p)) {
+        slab_free(heap, p);
+        return;
+    }
+
+    // mapped chunks are never this small
+    size = align_size(size);
+    if (size <= heap->quick_max && size < heap->opts.mmap_threshold) {
+        heap->counters.frees++;
+        quick_push(heap, (node_t *) ((char *) p - offset), size);
+        return;
+    }
+
+    heap_free(heap, p);
+}
+
+// merge a chunk with its free neighbours and put it in a bin. the merged
+// chunk keeps the stamp of its biggest part if that was waiting to be
+// purged, so freeing next to a big free chunk does not put its purge off.
+static void free_chunk(heap_t *heap, node_t *head) {
+    footer_t *new_foot, *old_foot;
     node_t *next = (node_t *) ((char *) get_foot(head) + sizeof(footer_t));
-    footer_t *f = (footer_t *) ((char *) head - sizeof(footer_t));
-    node_t *prev = f->header;
+    node_t *prev = NULL;
+    node_t *from = NULL;
+    size_t biggest = head->size;
+
+    // the first and last chunks have no neighbour on one side. the footer
+    // before head may be one heap_bump_alloc is moving, see there
+    if (head != (node_t *) (uintptr_t) heap->start) {
+        footer_t *f = (footer_t *) ((char *) head - sizeof(footer_t));
+        prev = __atomic_load_n(&f->header, __ATOMIC_ACQUIRE);
+    }
+    if (next == (node_t *) (uintptr_t) heap->end)
+        next = NULL;
     
-    if (prev->hole) {
-        list = heap->bins[get_bin_index(prev->size)];
-        remove_node(list, prev);
+    if (prev != NULL && prev->hole) {
+        if (prev->size > biggest) {
+            biggest = prev->size;
+            from = purgeable(heap, prev) ? prev : NULL;
+        }
+        remove_free(heap, prev);
+        heap->counters.coalesces++;
 
         prev->size += overhead + head->size;
+        prev->flags &= ~CHUNK_PURGED;
         new_foot = get_foot(head);
         new_foot->header = prev;
 
         head = prev;
     }
 
-    if (next->hole) {
-        list = heap->bins[get_bin_index(next->size)];
-        remove_node(list, next);
+    if (next != NULL && next->hole) {
+        if (next->size > biggest)
+            from = purgeable(heap, next) ? next : NULL;
+        remove_free(heap, next);
+        heap->counters.coalesces++;
 
         head->size += overhead + next->size;
+        head->flags &= ~CHUNK_PURGED;
 
         old_foot = get_foot(next);
         old_foot->header = 0;
@@ -105,26 +805,369 @@ void heap_free(heap_t *heap, void *p) {
     }
 
     head->hole = 1;
-    add_node(heap->bins[get_bin_index(head->size)], head);
+    stamp_free(heap, head, from);
+    insert_free(heap, head);
+
+    // give pages back once the wilderness gets too big, leaving some slack
+    if (head->size > MAX_WILDERNESS && head == get_wilderness(heap))
+        contract(heap, head->size - MAX_WILDERNESS / 2);
+}
+
+// with the heap held: reserve a span of span bytes from the wilderness for
+// bump, which must be empty, if a chunk of size bytes would have to come
+// from there anyway. returns 0 if the bins have one, so the caller takes
+// it from them rather than leaving it to fragment.
+uint heap_bump_reserve(heap_t *heap, bump_t *bump, size_t size, size_t span) {
+    size = align_size(size);
+    span = align_size(span);
+    if (span < size || span > heap_span(heap))
+        return 0;
+
+    if (size <= heap->quick_max && heap->quick[size / HEAP_ALIGN] != NULL)
+        return 0;
+
+    node_t *wild = get_wilderness(heap);
+    node_t *found = find_fit(heap, size);
+    if (found != NULL && found != wild)
+        return 0;
+
+    if (!wild->hole || wild->size < span + overhead + MIN_WILDERNESS) {
+        if (!expand(heap, span + overhead + HEAP_MIN_SIZE))
+            return 0;
+        wild = get_wilderness(heap);
+    }
+
+    remove_free(heap, wild);
+    split_chunk(heap, wild, span);
+    wild->hole = 0;
+    wild->flags &= ~CHUNK_PURGED;
+    mark_dirty(heap, wild);
+
+    bump->rest = wild;
+    bump->carved = 0;
+    return 1;
+}
+
+// carve size bytes off bump's span without touching the heap, or NULL if
+// the span is too small. the footer at the end of the span is published
+// with a release store once the new rest is fully written, so a thread
+// freeing the chunk after the span, which loads it with acquire, always
+// finds a header in use there, old or new.
+void *heap_bump_alloc(bump_t *bump, size_t size) {
+    node_t *node = bump->rest;
+    size = align_size(size);
+    if (node == NULL || node->size < size)
+        return NULL;
+
+    if (node->size - size <= overhead + MIN_ALLOC_SZ) {
+        bump->rest = NULL; // too little left for a chunk, hand out all of it
+    }
+    else {
+        node_t *rest = (node_t *) ((char *) node + overhead + size);
+        rest->hole = 0;
+        rest->flags = 0;
+        rest->size = node->size - size - overhead;
+        __atomic_store_n(&get_foot(rest)->header, rest, __ATOMIC_RELEASE);
+
+        node->size = size;
+        create_foot(node);
+        bump->rest = rest;
+    }
+
+    bump->carved++;
+    node->prev = NULL;
+    node->next = NULL;
+    return &node->next;
+}
+
+// with the heap held: free what is left of bump's span
+void heap_bump_release(heap_t *heap, bump_t *bump) {
+    heap->counters.allocs += bump->carved;
+    if (bump->rest != NULL)
+        free_chunk(heap, bump->rest);
+
+    bump->rest = NULL;
+    bump->carved = 0;
+}
+
+// allocate count * size zeroed bytes, or NULL if that overflows. only the
+// part of the chunk below heap->zero is cleared, fresh memory and mapped
+// chunks are zero already, and so are the pages of a purged chunk.
+void *heap_calloc(heap_t *heap, size_t count, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+        return NULL;
+
+    // a fresh mapping is zero already, and needs no hold on the heap
+    if (total >= heap->opts.mmap_threshold)
+        return huge_alloc(heap, total);
+
+    long zero = heap->zero;
+    heap->clean = NULL;
+    char *p = heap_alloc(heap, total);
+    if (p == NULL)
+        return NULL;
+
+    node_t *head = (node_t *) (p - offset);
+    if (slab_owns(heap, p)) {
+        memset(p, 0, total);
+        return p;
+    }
+    if (head->flags & CHUNK_MMAPPED || (long) p >= zero)
+        return p;
+
+    char *end = (long) (p + total) < zero ? p + total : (char *) zero;
+    if (heap->clean == head) {
+        char *lo = purge_start(heap, head);
+        char *hi = purge_end(heap, head);
+        if (lo < hi && lo < end) {
+            memset(p, 0, lo - p);
+            if (hi < end)
+                memset(hi, 0, end - hi);
+            return p;
+        }
+    }
+    memset(p, 0, end - p);
+    return p;
+}
+
+// resize a chunk without moving it: grow it into the free chunk after it
+// (growing the wilderness first if needed) or give its tail back to the
+// heap. returns 0 if the chunk has to move.
+uint heap_resize(heap_t *heap, void *p, size_t size) {
+    if (slab_owns(heap, p))
+        return size <= slab_size(p);
+
+    node_t *head = (node_t *) ((char *) p - offset);
+    if (head->flags & CHUNK_MMAPPED || size > heap_span(heap))
+        return 0;
+
+    size = align_size(size);
+    if (size > head->size) {
+        size_t need = size - head->size;
+        node_t *next = next_chunk(heap, head);
+
+        if (next == NULL || (next->hole && overhead + next->size < need && next == get_wilderness(heap))) {
+            expand(heap, need + overhead + HEAP_MIN_SIZE);
+            next = next_chunk(heap, head);
+        }
+
+        if (next == NULL || !next->hole || overhead + next->size < need)
+            return 0;
+
+        remove_free(heap, next);
+        head->size += overhead + next->size;
+        create_foot(head);
+    }
+
+    split_chunk(heap, head, size);
+    mark_dirty(heap, head);
+    return 1;
 }
 
+void *heap_realloc(heap_t *heap, void *p, size_t size) {
+    node_t *head = (node_t *) ((char *) p - offset);
+
+    if (!slab_owns(heap, p) && head->flags & CHUNK_MMAPPED && size >= heap->opts.mmap_threshold) {
+        // the kernel moves the pages, nothing is copied
+        if (size > SIZE_MAX - sizeof(node_t) - HEAP_PAGE_SIZE)
+            return NULL;
+
+        size_t len = page_round(sizeof(node_t) + size);
+        size_t old_len = sizeof(node_t) + head->size;
+        node_t *moved = mremap(head, old_len, len, MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED)
+            return NULL;
+
+        moved->size = len - sizeof(node_t);
+        __atomic_add_fetch(&heap->counters.mmapped, len - old_len, __ATOMIC_RELAXED);
+        return &moved->next;
+    }
+
+    if (heap_resize(heap, p, size))
+        return p;
+
+    size_t old_size = heap_usable_size(heap, p);
+    void *ret = heap_alloc(heap, size);
+    if (ret != NULL) {
+        memcpy(ret, p, size < old_size ? size : old_size);
+        heap_free(heap, p);
+    }
+    return ret;
+}
+
+size_t heap_usable_size(heap_t *heap, void *p) {
+    if (slab_owns(heap, p))
+        return slab_size(p);
+
+    node_t *head = (node_t *) ((char *) p - offset);
+    return head->size;
+}
+
+// fill in stats from the counters and a walk of the bins. the walk is
+// over free chunks only, so it is quick as long as the heap is not badly
+// fragmented. the caller has to hold the heap like for any other call.
+void heap_get_stats(heap_t *heap, heap_stats_t *stats) {
+    // queued chunks are free, not live
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = heap->end - heap->start;
+
+    size_t free_total = 0; // free chunks including their headers
+    for (uint i = 0; i < BIN_COUNT; i++) {
+        for (node_t *node = heap->bins[i]->head; node != NULL; node = node->next) {
+            stats->bin_chunks[i]++;
+            stats->free_bytes += node->size;
+            if (node->size > stats->largest_free)
+                stats->largest_free = node->size;
+            free_total += overhead + node->size;
+            if (node->flags & CHUNK_PURGED && purge_start(heap, node) < purge_end(heap, node))
+                stats->purged_bytes += purge_end(heap, node) - purge_start(heap, node);
+        }
+        stats->free_chunks += stats->bin_chunks[i];
+    }
+    stats->live_bytes = stats->heap_bytes - free_total;
+
+    node_t *wild = get_wilderness(heap);
+    if (wild->hole)
+        stats->wilderness = wild->size;
+
+    stats->quick_chunks = heap->quick_count;
+    stats->counters = heap->counters;
+    stats->counters.mmaps = __atomic_load_n(&heap->counters.mmaps, __ATOMIC_RELAXED);
+    stats->counters.munmaps = __atomic_load_n(&heap->counters.munmaps, __ATOMIC_RELAXED);
+    stats->counters.mmapped = __atomic_load_n(&heap->counters.mmapped, __ATOMIC_RELAXED);
+}
+
+// give the pages inside free chunks of at least purge_min bytes back to the
+// kernel once the chunks have been free for opts.purge_decay ms. the chunks
+// are marked purged so the next pass skips them, and so heap_calloc knows
+// their pages are zero. returns the bytes given back.
+size_t heap_purge(heap_t *heap) {
+    // chunks queued by other threads may be the ones worth purging
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    heap->purge_tick = 0;
+    if (heap->purge_min == 0)
+        return 0;
+
+    uint64_t now = now_ms();
+    size_t purged = 0;
+    for (uint i = find_bin(heap, get_bin_index(heap->purge_min)); i < BIN_COUNT; i = next_bin(heap, i)) {
+        for (node_t *node = heap->bins[i]->head; node != NULL; node = node->next) {
+            if (node->size < heap->purge_min || node->flags & CHUNK_PURGED)
+                continue;
+            if (now - *purge_stamp(node) < heap->opts.purge_decay)
+                continue;
+
+            char *start = purge_start(heap, node);
+            char *end = purge_end(heap, node);
+            if (start >= end)
+                continue;
+#ifdef MADV_FREE
+            int advice = heap->opts.purge_lazy ? MADV_FREE : MADV_DONTNEED;
+#else
+            int advice = MADV_DONTNEED;
+#endif
+            if (madvise(start, end - start, advice) != 0)
+                continue;
+            node->flags |= CHUNK_PURGED;
+            purged += end - start;
+        }
+    }
+    heap->counters.purged += purged;
+    return purged;
+}
+
+// map at least sz more bytes at the end of the heap and add them to the
+// wilderness. returns 0 if the heap is fixed or out of reserved space.
 uint expand(heap_t *heap, size_t sz) {
-    return 0;
+    sz = (sz + heap->page - 1) & ~(heap->page - 1);
+    if (heap->limit == 0 || sz > (size_t) (heap->limit - heap->end))
+        return 0;
+
+    if (mprotect((void *) heap->end, sz, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+
+    node_t *wild = get_wilderness(heap);
+    if (wild->hole) {
+        remove_free(heap, wild);
+        get_foot(wild)->header = NULL; // inside the wilderness from now on
+
+        // the page the footer was in was never purged. the wilderness keeps
+        // its stamp if it has one
+        node_t *from = purgeable(heap, wild) ? wild : NULL;
+        wild->size += sz;
+        wild->flags &= ~CHUNK_PURGED;
+        stamp_free(heap, wild, from);
+    }
+    else { // the last chunk is in use, the new pages become a chunk of their own
+        wild = (node_t *) heap->end;
+        wild->hole = 1;
+        wild->flags = 0;
+        wild->size = sz - overhead;
+    }
+
+    heap->end += sz;
+    create_foot(wild);
+    insert_free(heap, wild);
+    return 1;
 }
 
+// unmap whole pages from the end of the wilderness, keeping at least
+// MIN_WILDERNESS bytes in it
 void contract(heap_t *heap, size_t sz) {
-    return;
+    node_t *wild = get_wilderness(heap);
+
+    sz &= ~(heap->page - 1);
+    if (heap->limit == 0 || !wild->hole || sz == 0 || wild->size < sz + MIN_WILDERNESS)
+        return;
+
+    remove_free(heap, wild);
+    wild->size -= sz;
+    create_foot(wild);
+    insert_free(heap, wild);
+
+    heap->end -= sz;
+    madvise((void *) heap->end, sz, MADV_DONTNEED);
+    mprotect((void *) heap->end, sz, PROT_NONE);
+
+    // the pages come back zeroed when they are mapped in again
+    if (heap->zero > heap->end)
+        heap->zero = heap->end;
 }
 
+// the class a chunk of size sz is stored in
 uint get_bin_index(size_t sz) {
-    uint index = 0;
-    sz = sz < 4 ? 4 : sz;
+    uint fl, sl;
 
-    while (sz >>= 1) index++; 
-    index -= 2; 
-    
-    if (index > BIN_MAX_IDX) index = BIN_MAX_IDX; 
-    return index;
+    if (sz < SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = sz >> ALIGN_SIZE_LOG2;
+    }
+    else {
+        fl = fls_sizet(sz);
+        if (fl >= FL_INDEX_MAX) return BIN_MAX_IDX;
+
+        sl = (sz >> (fl - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        fl -= FL_INDEX_SHIFT - 1;
+    }
+    return fl * SL_INDEX_COUNT + sl;
+}
+
+// the first class whose chunks are all at least sz bytes, or BIN_COUNT
+uint get_fit_index(size_t sz) {
+    size_t width = (size_t) 1 << ALIGN_SIZE_LOG2;
+    if (sz >= (size_t) 1 << FL_INDEX_MAX) return BIN_COUNT;
+    if (sz >= SMALL_BLOCK_SIZE)
+        width = (size_t) 1 << (fls_sizet(sz) - SL_INDEX_COUNT_LOG2);
+
+    sz += width - 1;
+    if (sz >= (size_t) 1 << FL_INDEX_MAX) return BIN_COUNT;
+    return get_bin_index(sz);
 }
 
 void create_foot(node_t *head) {
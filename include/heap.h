@@ -8,19 +8,91 @@
 #define HEAP_MAX_SIZE 0xF0000
 #define HEAP_MIN_SIZE 0x10000
 
+#define HEAP_PAGE_SIZE 0x1000
+
+// huge page backing, see heap_opts_t. heaps that use it grow and shrink
+// by whole huge pages so the kernel never has to split them
+#define HEAP_HUGE_PAGE_SIZE 0x200000
+#define HEAP_HUGE_OFF 0 // normal pages
+#define HEAP_HUGE_THP 1 // transparent huge pages, through madvise(MADV_HUGEPAGE)
+#define HEAP_HUGE_TLB 2 // hugetlbfs pages reserved up front, THP if there are not enough
+
+// every pointer handed out is aligned to this, like max_align_t
+#define HEAP_ALIGN 16
+
 #define MIN_ALLOC_SZ 4
 
+// requests of at least this many bytes get a mapping of their own
+#define HEAP_MMAP_THRESHOLD 0x100000
+
+// small requests are served from slabs, SLAB_SIZE aligned blocks carved
+// from the heap that hold objects of one size class and no headers
+#define SLAB_SHIFT 16
+#define SLAB_SIZE (1 << SLAB_SHIFT)
+#define SLAB_CLASS_SZ 16
+#define SLAB_MAX_SZ 256
+#define SLAB_CLASSES (SLAB_MAX_SZ / SLAB_CLASS_SZ)
+#define HEAP_SLAB_OFF SIZE_MAX
+
+// with deferred coalescing on, freed chunks up to QUICK_MAX_SZ bytes wait
+// on per-size quick lists and are only merged once QUICK_FLUSH of them
+// have piled up, or when an allocation finds nothing else that fits
+#define QUICK_MAX_SZ 1024
+#define QUICK_COUNT (QUICK_MAX_SZ / HEAP_ALIGN + 1)
+#define QUICK_FLUSH 512
+
 #define MIN_WILDERNESS 0x2000
 #define MAX_WILDERNESS 0x1000000
 
-#define BIN_COUNT 9
+// default size of the spans bump allocators take from the wilderness
+#define BUMP_SPAN_SIZE 0x40000
+
+// with purging on, free chunks of at least opts.purge_limit bytes (never
+// less than PURGE_MIN_SZ) get the pages inside them given back once they
+// have stayed free for opts.purge_decay ms. heap_purge does the work, and
+// every PURGE_INTERVAL allocations from the bins call it.
+#define PURGE_MIN_SZ (4 * HEAP_PAGE_SIZE)
+#define PURGE_INTERVAL 256
+
+// Two-level segregated fit: the first level splits sizes by power of two,
+// the second level splits each power of two into SL_INDEX_COUNT linear
+// classes. Sizes below SMALL_BLOCK_SIZE all live in first level 0, and
+// sizes must stay below 1 << FL_INDEX_MAX.
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define ALIGN_SIZE_LOG2 3
+#define FL_INDEX_MAX 32
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+
+#define BIN_COUNT (FL_INDEX_COUNT * SL_INDEX_COUNT)
 #define BIN_MAX_IDX (BIN_COUNT - 1)
 
+// free-list insertion policies, see heap_opts_t
+#define HEAP_INSERT_LIFO   0 // push on the head of the bin, O(1)
+#define HEAP_INSERT_SORTED 1 // keep each bin sorted by size
+#define HEAP_INSERT_ADDR   2 // keep each bin sorted by address
+
+// fit policies, see heap_opts_t
+#define HEAP_FIT_GOOD  0 // first chunk of the first class that surely fits, sparing the wilderness
+#define HEAP_FIT_BEST  1 // smallest chunk that fits
+#define HEAP_FIT_FIRST 2 // lowest-addressed chunk that fits
+
+// node_t flags
+#define CHUNK_MMAPPED 0x1 // has its own mapping, outside of any heap
+#define CHUNK_PURGED  0x2 // free, and the pages inside it were given back
+
 typedef unsigned int uint;
 
+// 32 bytes, and 40 with the footer. hole, flags and size fill the 16 bytes
+// in front of next, which is the user pointer, so that it stays HEAP_ALIGN
+// aligned. packing the flags into size would leave a gap there instead of
+// making the header smaller.
 typedef struct node_t {
     uint hole;
-    uint size;
+    uint flags;
+    size_t size;
     struct node_t* next;
     struct node_t* prev;
 } node_t;
@@ -33,25 +105,120 @@ typedef struct {
     node_t* head;
 } bin_t;
 
+// per-heap settings, filled in by the caller before init_heap.
+// zero is the default for every field.
+typedef struct {
+    uint insert;           // HEAP_INSERT_*
+    uint fit;              // HEAP_FIT_*
+    size_t mmap_threshold; // HEAP_MMAP_THRESHOLD if 0, SIZE_MAX turns mmap off
+    size_t slab_limit;     // largest slab request, SLAB_MAX_SZ if 0, HEAP_SLAB_OFF turns slabs off
+    size_t quick_limit;    // largest chunk whose coalescing is deferred, 0 turns it off
+    uint huge;             // HEAP_HUGE_*, for heaps from map_heap and map_heap_at
+    size_t purge_limit;    // smallest free chunk whose pages are purged, 0 turns it off
+    uint purge_decay;      // ms a chunk has to stay free before it is purged
+    uint purge_lazy;       // purge with MADV_FREE, then the pages are not known to be zero
+} heap_opts_t;
+
+// event counts kept by every heap. they are plain increments on paths
+// that already hold the heap, except the mapped chunk ones, which are
+// updated atomically because those chunks are allocated without a lock.
+typedef struct {
+    size_t allocs;    // chunks and slab objects handed out
+    size_t frees;     // and given back
+    size_t splits;    // chunks cut in two
+    size_t coalesces; // free chunks merged with a neighbour
+    size_t mmaps;     // mapped chunks created
+    size_t munmaps;   // and unmapped
+    size_t mmapped;   // bytes in mapped chunks right now
+    size_t purged;    // bytes given back by heap_purge
+} heap_counters_t;
+
+// a snapshot of a heap, see heap_get_stats
+typedef struct heap_stats {
+    size_t heap_bytes;      // mapped between start and end
+    size_t live_bytes;      // in chunks in use, headers and slabs included
+    size_t free_bytes;      // usable bytes in free chunks
+    size_t free_chunks;
+    size_t largest_free;    // size of the largest free chunk
+    size_t wilderness;      // size of the wilderness, 0 if it is in use
+    size_t quick_chunks;    // freed chunks waiting to be coalesced, counted as live
+    size_t purged_bytes;    // of the free bytes, those in pages given back
+    size_t bin_chunks[BIN_COUNT];
+    heap_counters_t counters;
+} heap_stats_t;
+
+// a span cut from the wilderness that one thread carves chunks off the
+// front of without holding the heap, see heap_bump_alloc. the uncarved rest
+// is a chunk in use, so nothing coalesces into it while it is carved.
+typedef struct {
+    node_t *rest;  // the part not carved yet, NULL if there is no span
+    size_t carved; // chunks carved, added to the heap's allocs on release
+} bump_t;
+
+struct slab_t;
+
 typedef struct {
     long start;
-    long end;
+    long end;   // end of the mapped part of the heap
+    long limit; // end of the reserved address space, 0 if the heap cannot grow
+    size_t page; // expand and contract move end by multiples of this
     bin_t *bins[BIN_COUNT];
+    uint fl_bitmap;                 // bit fl set if any bin in fl is non-empty
+    uint sl_bitmap[FL_INDEX_COUNT]; // bit sl set if bin (fl, sl) is non-empty
+    heap_opts_t opts;
+    node_t *remote; // freed by other threads, see heap_free_remote
+    long zero;      // memory from here to end is still zero, see heap_calloc
+    heap_counters_t counters;
+    size_t slab_max;                    // requests up to this go to slabs, 0 if off
+    struct slab_t *slabs[SLAB_CLASSES]; // slabs with free objects, per class
+    unsigned char *slab_map;            // one bit per SLAB_SIZE block that is a slab
+    size_t quick_max;                   // chunks up to this go on quick lists, 0 if off
+    node_t *quick[QUICK_COUNT];         // freed chunks of one size, linked through next
+    uint quick_count;                   // chunks on all quick lists
+    size_t purge_min;   // free chunks from this size up are purged, 0 if off
+    uint purge_tick;    // allocations since the last heap_purge
+    node_t *clean;      // chunk just handed out that was purged, see heap_calloc
 } heap_t;
 
 static uint overhead = sizeof(footer_t) + sizeof(node_t);
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void init_heap(heap_t *heap, long start);
+uint map_heap(heap_t *heap, size_t reserve);
+uint map_heap_at(heap_t *heap, void *base, size_t reserve);
+void unmap_heap(heap_t *heap);
 
 void *heap_alloc(heap_t *heap, size_t size);
+void *heap_calloc(heap_t *heap, size_t count, size_t size);
 void heap_free(heap_t *heap, void *p);
+void heap_free_sized(heap_t *heap, void *p, size_t size);
+void heap_free_remote(heap_t *heap, void *p);
+size_t heap_alloc_batch(heap_t *heap, size_t size, size_t n, void **out);
+void heap_free_batch(heap_t *heap, void **ptrs, size_t n);
+void *heap_realloc(heap_t *heap, void *p, size_t size);
+uint heap_resize(heap_t *heap, void *p, size_t size);
+void *heap_alloc_aligned(heap_t *heap, size_t align, size_t size);
+size_t heap_usable_size(heap_t *heap, void *p);
+void heap_get_stats(heap_t *heap, struct heap_stats *stats);
+size_t heap_purge(heap_t *heap);
+uint heap_bump_reserve(heap_t *heap, bump_t *bump, size_t size, size_t span);
+void *heap_bump_alloc(bump_t *bump, size_t size);
+void heap_bump_release(heap_t *heap, bump_t *bump);
 uint expand(heap_t *heap, size_t sz);
 void contract(heap_t *heap, size_t sz);
 
 uint get_bin_index(size_t sz);
+uint get_fit_index(size_t sz);
 void create_foot(node_t *head);
 footer_t *get_foot(node_t *head);
 
 node_t *get_wilderness(heap_t *heap);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef HEAP_ALLOCATOR_HPP
+#define HEAP_ALLOCATOR_HPP
+
+#include "heap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+// standard allocator that takes its memory from one heap_t, so a container
+// can live in a heap of its own. the heap is not locked: containers that
+// share a heap have to be used from one thread at a time.
+template <typename T>
+class heap_allocator {
+public:
+    using value_type = T;
+
+    // containers that are moved or swapped take the heap with them
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit heap_allocator(heap_t *heap) noexcept : heap_(heap) {}
+
+    template <typename U>
+    heap_allocator(const heap_allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    T *allocate(std::size_t n) {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_array_new_length();
+
+        // the heap hands out nothing for zero bytes
+        std::size_t size = n != 0 ? n * sizeof(T) : 1;
+        void *p = alignof(T) > HEAP_ALIGN ? heap_alloc_aligned(heap_, alignof(T), size)
+                                          : heap_alloc(heap_, size);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        heap_free_sized(heap_, p, n != 0 ? n * sizeof(T) : 1);
+    }
+
+    heap_t *heap() const noexcept { return heap_; }
+
+private:
+    heap_t *heap_;
+};
+
+// memory from one heap can only be freed to the same heap
+template <typename T, typename U>
+bool operator==(const heap_allocator<T> &a, const heap_allocator<U> &b) noexcept {
+    return a.heap() == b.heap();
+}
+
+template <typename T, typename U>
+bool operator!=(const heap_allocator<T> &a, const heap_allocator<U> &b) noexcept {
+    return a.heap() != b.heap();
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdint.h>
 
 void add_node(bin_t *bin, node_t *node);
+void add_node_lifo(bin_t *bin, node_t *node);
+void add_node_addr(bin_t *bin, node_t *node);
 
 void remove_node(bin_t *bin, node_t *node);
 
@@ -0,0 +1,46 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "heap.h"
+#include <stdint.h>
+
+// a pool hands out objects of one size from slabs taken from a heap. the
+// objects have no header: a slab is aligned to its own size, so the slab
+// an object belongs to is found by masking its address.
+#define POOL_SLAB_SIZE 0x10000
+#define POOL_MIN_OBJECTS 8 // slabs grow until at least this many objects fit
+
+// header at the start of every slab, the objects follow it
+typedef struct pool_slab_t {
+    struct pool_slab_t *next;
+    struct pool_slab_t *prev;
+    void *free;  // freed objects, linked through their first word
+    uint carved; // objects handed out at least once
+    uint used;   // objects in use
+} pool_slab_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    heap_t *heap;
+    size_t size;         // object size, a multiple of the alignment
+    size_t header;       // slab header, rounded up to the alignment
+    size_t slab_size;    // a power of two
+    uint count;          // objects per slab
+    pool_slab_t *slabs;  // slabs with free objects
+    pool_slab_t *full;   // slabs without
+} pool_t;
+
+uint pool_init(pool_t *pool, heap_t *heap, size_t size, size_t align);
+void pool_destroy(pool_t *pool);
+
+void *pool_alloc(pool_t *pool);
+void pool_free(pool_t *pool, void *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
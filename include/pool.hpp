@@ -0,0 +1,52 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include "pool.h"
+
+#include <new>
+#include <utility>
+
+// typed wrapper around pool_t: objects of T constructed in place in
+// memory from the pool.
+template <typename T>
+class object_pool {
+public:
+    explicit object_pool(heap_t *heap) {
+        if (!pool_init(&pool_, heap, sizeof(T), alignof(T)))
+            throw std::bad_alloc();
+    }
+
+    ~object_pool() { pool_destroy(&pool_); }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    // raw storage for one T, nullptr if the heap is out of memory
+    void *allocate() noexcept { return pool_alloc(&pool_); }
+    void deallocate(void *p) noexcept { pool_free(&pool_, p); }
+
+    template <typename... Args>
+    T *create(Args &&...args) {
+        void *p = allocate();
+        if (p == nullptr)
+            throw std::bad_alloc();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    void destroy(T *obj) noexcept {
+        if (obj == nullptr)
+            return;
+        obj->~T();
+        deallocate(obj);
+    }
+
+private:
+    pool_t pool_;
+};
+
+#endif
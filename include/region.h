@@ -0,0 +1,61 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "heap.h"
+#include <stdint.h>
+
+// a region hands out memory by bumping a pointer through blocks carved
+// from a heap. nothing is freed on its own: everything allocated after a
+// mark goes at once with region_rewind, and everything with region_release.
+#define REGION_BLOCK_SIZE 0x10000
+#define REGION_ALIGN HEAP_ALIGN
+
+// header at the start of every block, the allocations follow it
+typedef struct region_block_t {
+    struct region_block_t *prev; // the block before this one
+    size_t size;                 // bytes after the header
+} region_block_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    heap_t *heap;
+    char *cur; // next free byte in the current block
+    char *end; // end of the current block
+    region_block_t *block;
+    size_t block_size;
+} region_t;
+
+typedef struct {
+    region_block_t *block;
+    char *cur;
+} region_mark_t;
+
+void region_init(region_t *region, heap_t *heap, size_t block_size);
+void *region_alloc_block(region_t *region, size_t size);
+void region_rewind(region_t *region, region_mark_t mark);
+void region_release(region_t *region);
+
+// the fast path is just a bump, a new block is only needed when it is full
+static inline void *region_alloc(region_t *region, size_t size) {
+    size_t rounded = (size + REGION_ALIGN - 1) & ~(size_t) (REGION_ALIGN - 1);
+    if (rounded >= size && rounded <= (size_t) (region->end - region->cur)) {
+        void *p = region->cur;
+        region->cur += rounded;
+        return p;
+    }
+    return region_alloc_block(region, size);
+}
+
+static inline region_mark_t region_mark(region_t *region) {
+    region_mark_t mark = { region->block, region->cur };
+    return mark;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
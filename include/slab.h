@@ -0,0 +1,26 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "heap.h"
+#include <stdint.h>
+
+// header at the start of every slab, the objects follow it
+typedef struct slab_t {
+    struct slab_t *next;
+    struct slab_t *prev;
+    void *free;  // freed objects, linked through their first word
+    uint size;   // object size
+    uint count;  // objects that fit in the slab
+    uint carved; // objects handed out at least once
+    uint used;   // objects in use
+} slab_t;
+
+void slab_init(heap_t *heap, size_t limit);
+
+void *slab_alloc(heap_t *heap, size_t size);
+void slab_free(heap_t *heap, void *p);
+
+uint slab_owns(heap_t *heap, void *p);
+size_t slab_size(void *p);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// set MYALLOC_TRACE=<file> to record every allocator call into <file>
+#define TRACE_ENV "MYALLOC_TRACE"
+
+#define TRACE_MAGIC 0x5443415254414d53ULL // "SMATRACT"
+#define TRACE_VERSION 1
+
+// events kept per thread before the drainer catches up; once a ring is
+// full new events are dropped rather than making the thread wait
+#define TRACE_RING_SIZE 4096
+#define TRACE_DRAIN_MS 10
+
+// trace_event_t ops
+#define TRACE_MALLOC  1
+#define TRACE_CALLOC  2
+#define TRACE_REALLOC 3
+#define TRACE_FREE    4
+#define TRACE_ALIGNED 5
+
+// the file is a trace_header_t followed by trace_event_t records, in the
+// order they were drained: each thread's events are in order, but
+// different threads are interleaved by drain, so sort on time to merge
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t event_size;
+} trace_header_t;
+
+typedef struct {
+    uint64_t time; // CLOCK_MONOTONIC, in ns
+    uint64_t ptr;  // pointer returned, or freed
+    uint64_t old;  // pointer passed to realloc, alignment for TRACE_ALIGNED
+    uint64_t size; // size requested
+    uint32_t tid;
+    uint32_t op;   // TRACE_*
+} trace_event_t;
+
+extern int g_trace_on;
+
+void trace_record(uint32_t op, void *ptr, void *old, size_t size);
+void trace_flush(void);
+
+// a single predictable branch when tracing is off
+static inline void trace_event(uint32_t op, void *ptr, void *old, size_t size) {
+    if (__builtin_expect(g_trace_on, 0))
+        trace_record(op, ptr, old, size);
+}
+
+#endif
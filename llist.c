@@ -41,28 +41,47 @@ void add_node(bin_t *bin, node_t* node) {
     }
 }
 
-void remove_node(bin_t * bin, node_t *node) {
-    if (bin->head == NULL) return; 
-    if (bin->head == node) { 
-        bin->head = bin->head->next;
-        return;
-    }
-    
-    node_t *temp = bin->head->next;
-    while (temp != NULL) {
-        if (temp == node) { // found the node
-            if (temp->next == NULL) { // last item
-                temp->prev->next = NULL;
-            }
-            else { // middle item
-                temp->prev->next = temp->next;
-                temp->next->prev = temp->prev;
-            }
-            // we dont worry about deleting the head here because we already checked that
-            return;
-        }
-        temp = temp->next;
+void add_node_lifo(bin_t *bin, node_t *node) {
+    node->prev = NULL;
+    node->next = bin->head;
+
+    if (bin->head != NULL)
+        bin->head->prev = node;
+    bin->head = node;
+}
+
+void add_node_addr(bin_t *bin, node_t *node) {
+    node->next = NULL;
+    node->prev = NULL;
+
+    // find the last node with a lower address, node goes right after it
+    node_t *current = bin->head;
+    node_t *previous = NULL;
+    while (current != NULL && current < node) {
+        previous = current;
+        current = current->next;
     }
+
+    node->prev = previous;
+    node->next = current;
+    if (current != NULL) current->prev = node;
+
+    if (previous != NULL) previous->next = node;
+    else bin->head = node;
+}
+
+void remove_node(bin_t * bin, node_t *node) {
+    // the links are always kept up to date so no search is needed
+    if (node->prev != NULL) 
+        node->prev->next = node->next;
+    else // node is the head
+        bin->head = node->next;
+
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+
+    node->next = NULL;
+    node->prev = NULL;
 }
 
 node_t *get_best_fit(bin_t *bin, size_t size) {
@@ -56,6 +56,13 @@ int main(int argc, char** argv) {
 
     for (i = 1; i <= 2048; i += i) printf("size: %d -> bin: %d \n", i, get_bin_index(i));
 
+    heap_stats_t stats;
+    heap_get_stats(heap, &stats);
+    printf("\nlive: %zu bytes, free: %zu bytes in %zu chunks, largest free: %zu \n",
+           stats.live_bytes, stats.free_bytes, stats.free_chunks, stats.largest_free);
+    printf("allocs: %zu, frees: %zu, splits: %zu, coalesces: %zu \n",
+           stats.counters.allocs, stats.counters.frees, stats.counters.splits, stats.counters.coalesces);
+
     for (i = 0; i < BIN_COUNT; i++) {
         free(heap->bins[i]);
     }
@@ -0,0 +1,156 @@
+// C++ allocation hooks for libmyalloc.so. Every operator new and delete goes
+// straight to the allocator instead of through libstdc++'s wrappers, and the
+// size and alignment the compiler passes along are kept.
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "include/heap.h"
+
+extern "C" void free_sized(void *p, std::size_t size) noexcept;
+extern "C" void free_aligned_sized(void *p, std::size_t alignment, std::size_t size) noexcept;
+
+namespace
+{
+
+// The loop every throwing operator new runs: call the new_handler until it
+// frees enough memory, or throw if there is none.
+void *new_impl(std::size_t size, std::size_t alignment)
+{
+  // Every call has to return a distinct pointer, even for zero bytes.
+  if (size == 0)
+  {
+    size = 1;
+  }
+  for (;;)
+  {
+    void *p = alignment <= HEAP_ALIGN ? malloc(size) : aligned_alloc(alignment, size);
+    if (p != nullptr)
+    {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+// The nothrow forms behave as if they called the throwing ones.
+void *new_nothrow(std::size_t size, std::size_t alignment) noexcept
+{
+  try
+  {
+    return new_impl(size, alignment);
+  }
+  catch (...)
+  {
+    return nullptr;
+  }
+}
+
+} // namespace
+
+void *operator new(std::size_t size)
+{
+  return new_impl(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+  return new_impl(size, 0);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+  return new_nothrow(size, 0);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+  return new_nothrow(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+  return new_impl(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return new_impl(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+// The size a sized delete is given is the one the object was allocated
+// with, so it goes through free_sized.
+void operator delete(void *p, std::size_t size) noexcept
+{
+  free_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+  free_sized(p, size);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t alignment) noexcept
+{
+  free_aligned_sized(p, static_cast<std::size_t>(alignment), size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t alignment) noexcept
+{
+  free_aligned_sized(p, static_cast<std::size_t>(alignment), size);
+}
@@ -0,0 +1,112 @@
+#include "include/pool.h"
+
+static pool_slab_t *slab_of(pool_t *pool, void *p) {
+    return (pool_slab_t *) ((uintptr_t) p & ~(uintptr_t) (pool->slab_size - 1));
+}
+
+static void link_slab(pool_slab_t **list, pool_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+    *list = slab;
+}
+
+static void unlink_slab(pool_slab_t **list, pool_slab_t *slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+// set up a pool of size byte objects aligned to align, a power of two.
+// nothing is taken from the heap until the first allocation. returns 0 if
+// the size or alignment cannot be served.
+uint pool_init(pool_t *pool, heap_t *heap, size_t size, size_t align) {
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    if ((align & (align - 1)) != 0 || size > SIZE_MAX / 2 / POOL_MIN_OBJECTS)
+        return 0;
+
+    // every object has to hold the free list link
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+
+    pool->heap = heap;
+    pool->size = (size + align - 1) & ~(align - 1);
+    pool->header = (sizeof(pool_slab_t) + align - 1) & ~(align - 1);
+    pool->slab_size = POOL_SLAB_SIZE;
+    while ((pool->slab_size - pool->header) / pool->size < POOL_MIN_OBJECTS)
+        pool->slab_size <<= 1;
+    pool->count = (pool->slab_size - pool->header) / pool->size;
+    pool->slabs = NULL;
+    pool->full = NULL;
+    return 1;
+}
+
+// give every slab back to the heap, whether its objects are freed or not
+void pool_destroy(pool_t *pool) {
+    pool_slab_t *lists[2] = { pool->slabs, pool->full };
+
+    for (int i = 0; i < 2; i++) {
+        pool_slab_t *slab = lists[i];
+        while (slab != NULL) {
+            pool_slab_t *next = slab->next;
+            heap_free(pool->heap, slab);
+            slab = next;
+        }
+    }
+    pool->slabs = NULL;
+    pool->full = NULL;
+}
+
+void *pool_alloc(pool_t *pool) {
+    pool_slab_t *slab = pool->slabs;
+
+    if (slab == NULL) {
+        slab = heap_alloc_aligned(pool->heap, pool->slab_size, pool->slab_size);
+        if (slab == NULL)
+            return NULL;
+
+        slab->free = NULL;
+        slab->carved = 0;
+        slab->used = 0;
+        link_slab(&pool->slabs, slab);
+    }
+
+    // reuse the last freed object, or carve one that was never handed out
+    void *p = slab->free;
+    if (p != NULL)
+        slab->free = *(void **) p;
+    else
+        p = (char *) slab + pool->header + (size_t) slab->carved++ * pool->size;
+
+    if (++slab->used == pool->count) {
+        unlink_slab(&pool->slabs, slab);
+        link_slab(&pool->full, slab);
+    }
+    return p;
+}
+
+void pool_free(pool_t *pool, void *p) {
+    pool_slab_t *slab = slab_of(pool, p);
+
+    if (slab->used == pool->count) {
+        unlink_slab(&pool->full, slab);
+        link_slab(&pool->slabs, slab);
+    }
+
+    *(void **) p = slab->free;
+    slab->free = p;
+    slab->used--;
+
+    // give empty slabs back, but keep the last one so allocating and
+    // freeing one object does not take and return a slab every time
+    if (slab->used == 0 && (pool->slabs != slab || slab->next != NULL)) {
+        unlink_slab(&pool->slabs, slab);
+        heap_free(pool->heap, slab);
+    }
+}
@@ -0,0 +1,57 @@
+#include "include/region.h"
+
+// the header keeps the allocations after it REGION_ALIGN aligned
+#define BLOCK_HEADER_SZ ((sizeof(region_block_t) + REGION_ALIGN - 1) & ~(size_t) (REGION_ALIGN - 1))
+
+// nothing is taken from the heap until the first allocation
+void region_init(region_t *region, heap_t *heap, size_t block_size) {
+    region->heap = heap;
+    region->cur = NULL;
+    region->end = NULL;
+    region->block = NULL;
+    region->block_size = block_size ? block_size : REGION_BLOCK_SIZE;
+}
+
+// start a new block big enough for size and allocate from it. the rest of
+// the current block is given up.
+void *region_alloc_block(region_t *region, size_t size) {
+    size_t rounded = (size + REGION_ALIGN - 1) & ~(size_t) (REGION_ALIGN - 1);
+    if (rounded < size || rounded > SIZE_MAX - BLOCK_HEADER_SZ)
+        return NULL;
+
+    size_t bytes = rounded > region->block_size ? rounded : region->block_size;
+    region_block_t *block = heap_alloc(region->heap, BLOCK_HEADER_SZ + bytes);
+    if (block == NULL)
+        return NULL;
+
+    block->prev = region->block;
+    block->size = bytes;
+    region->block = block;
+    region->cur = (char *) block + BLOCK_HEADER_SZ + rounded;
+    region->end = (char *) block + BLOCK_HEADER_SZ + bytes;
+    return (char *) block + BLOCK_HEADER_SZ;
+}
+
+// drop everything allocated since mark was taken. blocks started after it
+// go back to the heap.
+void region_rewind(region_t *region, region_mark_t mark) {
+    while (region->block != mark.block) {
+        region_block_t *prev = region->block->prev;
+        heap_free(region->heap, region->block);
+        region->block = prev;
+    }
+
+    if (mark.block == NULL) {
+        region->cur = NULL;
+        region->end = NULL;
+        return;
+    }
+    region->cur = mark.cur;
+    region->end = (char *) mark.block + BLOCK_HEADER_SZ + mark.block->size;
+}
+
+// give every block back, the region can be used again afterwards
+void region_release(region_t *region) {
+    region_mark_t empty = { NULL, NULL };
+    region_rewind(region, empty);
+}
@@ -0,0 +1,509 @@
+// replays a trace recorded with MYALLOC_TRACE against heap_alloc/heap_free
+// and against the system malloc, and reports throughput, latency
+// percentiles, peak RSS and fragmentation (peak RSS over the peak of the
+// bytes the trace has live) for each.
+//
+//   replay <trace>                 run the trace against both allocators
+//   replay -a heap|system <trace>  run it against one of them
+//   replay -c <out> <trace>        write the compact form of the trace to <out>
+//   replay -f good|best|first -i lifo|sorted|addr <trace>
+//                                  pick the heap's fit and insertion policies
+//   replay -p small|thp|tlb <trace>
+//                                  back the heap with small or huge pages
+//
+// the recorded addresses are only meaningful to the allocator that handed
+// them out, so they are turned into ptr-ids when the trace is loaded: every
+// allocation gets the next id and every free or realloc is matched to the
+// live allocation at that address. the result is a compact op list of
+// (op, size, ptr-id, thread, timestamp) that can be written out with -c
+// and loaded again in place of the raw trace.
+//
+// all threads are merged on their timestamps and replayed in one thread, so
+// every run of the same trace performs exactly the same calls.
+
+#include "include/heap.h"
+#include "include/trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define REPLAY_MAGIC 0x53504f59414c5052ULL // "RPLAYOPS"
+#define REPLAY_VERSION 1
+
+typedef struct {
+    uint64_t time; // ns since the first event
+    uint64_t size;
+    uint32_t id;   // ptr-id, see above
+    uint16_t tid;  // threads are numbered in the order they first appear
+    uint8_t op;    // TRACE_*
+    uint8_t align; // log2 of the alignment, TRACE_ALIGNED only
+} replay_op_t;
+
+typedef struct {
+    replay_op_t *ops;
+    size_t count;
+    uint32_t ids;
+    uint32_t threads;
+} replay_t;
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void *(*alloc)(size_t size);
+    void *(*zalloc)(size_t size);
+    void *(*aligned)(size_t align, size_t size);
+    void *(*realloc)(void *p, size_t size);
+    void (*free)(void *p);
+} allocator_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ========================= loading =========================
+
+// address -> ptr-id, open addressing with linear probing. the table has
+// room for every allocation in the trace, so it never fills up.
+typedef struct {
+    uint64_t *keys; // 0 is empty
+    uint32_t *vals;
+    size_t mask;
+} addr_map_t;
+
+static size_t addr_slot(addr_map_t *map, uint64_t addr) {
+    size_t i = (addr >> 4) * 0x9e3779b97f4a7c15ULL & map->mask;
+    while (map->keys[i] != 0 && map->keys[i] != addr)
+        i = (i + 1) & map->mask;
+    return i;
+}
+
+static void addr_put(addr_map_t *map, uint64_t addr, uint32_t id) {
+    size_t i = addr_slot(map, addr);
+    map->keys[i] = addr;
+    map->vals[i] = id;
+}
+
+// removes addr and returns its id, or UINT32_MAX if it is not live
+static uint32_t addr_take(addr_map_t *map, uint64_t addr) {
+    size_t i = addr_slot(map, addr);
+    if (map->keys[i] == 0)
+        return UINT32_MAX;
+
+    uint32_t id = map->vals[i];
+    map->keys[i] = 0;
+
+    // shift the rest of the cluster back so no probe chain is broken
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & map->mask;
+        if (map->keys[j] == 0)
+            break;
+        size_t home = (map->keys[j] >> 4) * 0x9e3779b97f4a7c15ULL & map->mask;
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->keys[i] = map->keys[j];
+            map->vals[i] = map->vals[j];
+            map->keys[j] = 0;
+            i = j;
+        }
+    }
+    return id;
+}
+
+static trace_event_t *g_events;
+
+// by time, and by position in the file for equal times
+static int by_time(const void *a, const void *b) {
+    const trace_event_t *x = &g_events[*(const uint32_t *) a];
+    const trace_event_t *y = &g_events[*(const uint32_t *) b];
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return *(const uint32_t *) a < *(const uint32_t *) b ? -1 : 1;
+}
+
+static uint8_t log2_of(uint64_t x) {
+    uint8_t n = 0;
+    while ((1ULL << n) < x)
+        n++;
+    return n;
+}
+
+static uint16_t thread_index(uint32_t *tids, uint32_t *count, uint32_t tid) {
+    for (uint32_t i = 0; i < *count; i++) {
+        if (tids[i] == tid)
+            return i;
+    }
+    if (*count == UINT16_MAX)
+        return UINT16_MAX - 1;
+    tids[*count] = tid;
+    return (*count)++;
+}
+
+// turn raw events into ops. frees of memory that was allocated before
+// tracing started cannot be replayed and are dropped.
+static void resolve(replay_t *r, trace_event_t *events, size_t count) {
+    uint32_t *order = malloc(count * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++)
+        order[i] = i;
+    g_events = events;
+    qsort(order, count, sizeof(uint32_t), by_time);
+
+    addr_map_t map;
+    size_t cap = 16;
+    while (cap < count * 2)
+        cap <<= 1;
+    map.keys = calloc(cap, sizeof(uint64_t));
+    map.vals = malloc(cap * sizeof(uint32_t));
+    map.mask = cap - 1;
+
+    uint32_t *tids = malloc(UINT16_MAX * sizeof(uint32_t));
+    r->ops = malloc(count * sizeof(replay_op_t));
+    r->count = 0;
+    r->ids = 0;
+    r->threads = 0;
+
+    uint64_t first = count > 0 ? events[order[0]].time : 0;
+    for (size_t i = 0; i < count; i++) {
+        trace_event_t *e = &events[order[i]];
+        replay_op_t op = { e->time - first, e->size, 0, 0, e->op, 0 };
+
+        switch (e->op) {
+        case TRACE_MALLOC:
+        case TRACE_CALLOC:
+        case TRACE_ALIGNED:
+            if (e->ptr == 0)
+                continue;
+            if (e->op == TRACE_ALIGNED)
+                op.align = log2_of(e->old);
+            op.id = r->ids++;
+            addr_put(&map, e->ptr, op.id);
+            break;
+        case TRACE_FREE:
+            if ((op.id = addr_take(&map, e->ptr)) == UINT32_MAX)
+                continue;
+            break;
+        case TRACE_REALLOC:
+            if (e->old == 0) {
+                // realloc(NULL, size) is a malloc
+                if (e->ptr == 0)
+                    continue;
+                op.op = TRACE_MALLOC;
+                op.id = r->ids++;
+            } else if ((op.id = addr_take(&map, e->old)) == UINT32_MAX) {
+                continue;
+            } else if (e->size == 0) {
+                op.op = TRACE_FREE;
+                break;
+            } else if (e->ptr == 0) {
+                // failed, the old pointer is still live
+                addr_put(&map, e->old, op.id);
+                continue;
+            }
+            // the id follows the memory to its new address
+            addr_put(&map, e->ptr, op.id);
+            break;
+        default:
+            continue;
+        }
+
+        op.tid = thread_index(tids, &r->threads, e->tid);
+        r->ops[r->count++] = op;
+    }
+
+    free(tids);
+    free(map.keys);
+    free(map.vals);
+    free(order);
+}
+
+static int load(replay_t *r, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size_t bytes = ftell(f) - sizeof(header);
+    fseek(f, sizeof(header), SEEK_SET);
+
+    if (header.magic == REPLAY_MAGIC && header.version == REPLAY_VERSION &&
+        header.event_size == sizeof(replay_op_t)) {
+        // already compact
+        r->count = bytes / sizeof(replay_op_t);
+        r->ops = malloc(r->count * sizeof(replay_op_t));
+        r->count = fread(r->ops, sizeof(replay_op_t), r->count, f);
+        r->ids = 0;
+        r->threads = 0;
+        for (size_t i = 0; i < r->count; i++) {
+            if (r->ops[i].id >= r->ids)
+                r->ids = r->ops[i].id + 1;
+            if (r->ops[i].tid >= r->threads)
+                r->threads = r->ops[i].tid + 1;
+        }
+    } else if (header.magic == TRACE_MAGIC && header.version == TRACE_VERSION &&
+               header.event_size == sizeof(trace_event_t)) {
+        size_t count = bytes / sizeof(trace_event_t);
+        trace_event_t *events = malloc(count * sizeof(trace_event_t));
+        count = fread(events, sizeof(trace_event_t), count, f);
+        resolve(r, events, count);
+        free(events);
+    } else {
+        fprintf(stderr, "%s: unknown trace format\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    fclose(f);
+    return 1;
+}
+
+static int save(replay_t *r, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    trace_header_t header = { REPLAY_MAGIC, REPLAY_VERSION, sizeof(replay_op_t) };
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(r->ops, sizeof(replay_op_t), r->count, f) == r->count;
+    return fclose(f) == 0 && ok;
+}
+
+// ========================= allocators =========================
+
+static heap_t g_heap;
+static bin_t g_bins[BIN_COUNT];
+static heap_opts_t g_opts;
+
+static void heap_setup(void) {
+    for (int i = 0; i < BIN_COUNT; i++)
+        g_heap.bins[i] = &g_bins[i];
+    g_heap.opts = g_opts;
+    if (!map_heap(&g_heap, HEAP_INIT_SIZE)) {
+        fprintf(stderr, "map_heap failed\n");
+        exit(1);
+    }
+}
+
+static void *heap_malloc(size_t size) {
+    return heap_alloc(&g_heap, size);
+}
+
+// heap_calloc clears only what was handed out before, like a real calloc
+static void *heap_zalloc(size_t size) {
+    return heap_calloc(&g_heap, 1, size);
+}
+
+static void *heap_memalign(size_t align, size_t size) {
+    return heap_alloc_aligned(&g_heap, align, size);
+}
+
+static void *heap_resize_to(void *p, size_t size) {
+    return heap_realloc(&g_heap, p, size);
+}
+
+static void heap_release(void *p) {
+    heap_free(&g_heap, p);
+}
+
+static void sys_setup(void) {
+}
+
+static void *sys_zalloc(size_t size) {
+    return calloc(1, size);
+}
+
+static void *sys_memalign(size_t align, size_t size) {
+    void *p;
+    return posix_memalign(&p, align, size) == 0 ? p : NULL;
+}
+
+static const allocator_t allocators[] = {
+    { "heap", heap_setup, heap_malloc, heap_zalloc, heap_memalign, heap_resize_to, heap_release },
+    { "system", sys_setup, malloc, sys_zalloc, sys_memalign, realloc, free },
+};
+
+// ========================= replay =========================
+
+static long status_kb(const char *field) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return 0;
+
+    char line[256];
+    long kb = 0;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, len) == 0) {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+static int by_value(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(replay_t *r, const allocator_t *a) {
+    void **slots = calloc(r->ids ? r->ids : 1, sizeof(void *));
+    uint64_t *sizes = calloc(r->ids ? r->ids : 1, sizeof(uint64_t));
+    uint32_t *lat = malloc((r->count ? r->count : 1) * sizeof(uint32_t));
+    memset(lat, 0, r->count * sizeof(uint32_t));
+
+    a->setup();
+    long base_kb = status_kb("VmRSS:");
+
+    uint64_t total = 0;
+    uint64_t live = 0, peak_live = 0;
+    for (size_t i = 0; i < r->count; i++) {
+        replay_op_t *op = &r->ops[i];
+        void **slot = &slots[op->id];
+        void *p = NULL;
+
+        uint64_t t0 = now_ns();
+        switch (op->op) {
+        case TRACE_MALLOC:
+            p = a->alloc(op->size);
+            break;
+        case TRACE_CALLOC:
+            p = a->zalloc(op->size);
+            break;
+        case TRACE_ALIGNED:
+            p = a->aligned((size_t) 1 << op->align, op->size);
+            break;
+        case TRACE_REALLOC:
+            // the slot is only empty if an earlier allocation failed
+            p = *slot ? a->realloc(*slot, op->size) : a->alloc(op->size);
+            break;
+        case TRACE_FREE:
+            if (*slot)
+                a->free(*slot);
+            break;
+        }
+        uint64_t t1 = now_ns();
+
+        // write the memory like the program that was traced would, so the
+        // pages count towards the RSS
+        if (p != NULL)
+            memset(p, 1, op->size);
+        *slot = p;
+
+        // bytes the traced program asked for and still holds
+        live -= sizes[op->id];
+        sizes[op->id] = p != NULL ? op->size : 0;
+        live += sizes[op->id];
+        if (live > peak_live)
+            peak_live = live;
+
+        total += t1 - t0;
+        lat[i] = t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0;
+    }
+
+    long peak_kb = status_kb("VmHWM:") - base_kb;
+    qsort(lat, r->count, sizeof(uint32_t), by_value);
+
+    size_t n = r->count ? r->count : 1;
+    printf("%-8s %14.0f %8u %8u %8u %10u %10.1f %8.2f\n", a->name,
+           total ? r->count * 1e9 / total : 0.0,
+           lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1],
+           peak_kb / 1024.0, peak_live ? peak_kb * 1024.0 / peak_live : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *only = NULL;
+    const char *out = NULL;
+    int opt;
+
+    static const char *fits[] = { "good", "best", "first" };
+    static const char *inserts[] = { "lifo", "sorted", "addr" };
+    static const char *pages[] = { "small", "thp", "tlb" };
+    int bad = 0;
+
+    while ((opt = getopt(argc, argv, "a:c:f:i:p:")) != -1) {
+        switch (opt) {
+        case 'a':
+            only = optarg;
+            break;
+        case 'c':
+            out = optarg;
+            break;
+        case 'f':
+            for (g_opts.fit = 0; g_opts.fit < 3 && strcmp(optarg, fits[g_opts.fit]) != 0; g_opts.fit++)
+                ;
+            bad |= g_opts.fit == 3;
+            break;
+        case 'i':
+            for (g_opts.insert = 0; g_opts.insert < 3 && strcmp(optarg, inserts[g_opts.insert]) != 0; g_opts.insert++)
+                ;
+            bad |= g_opts.insert == 3;
+            break;
+        case 'p':
+            for (g_opts.huge = 0; g_opts.huge < 3 && strcmp(optarg, pages[g_opts.huge]) != 0; g_opts.huge++)
+                ;
+            bad |= g_opts.huge == 3;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-a heap|system] [-f good|best|first] [-i lifo|sorted|addr] [-p small|thp|tlb] [-c out] <trace>\n", argv[0]);
+        return 2;
+    }
+
+    replay_t r;
+    if (!load(&r, argv[optind]))
+        return 1;
+
+    if (out != NULL) {
+        if (!save(&r, out)) {
+            fprintf(stderr, "%s: write failed\n", out);
+            return 1;
+        }
+        printf("%zu ops, %u ptr-ids, %u threads -> %s\n", r.count, r.ids, r.threads, out);
+        return 0;
+    }
+
+    printf("%zu ops, %u ptr-ids, %u threads\n\n", r.count, r.ids, r.threads);
+    printf("%-8s %14s %8s %8s %8s %10s %10s %8s\n",
+           "alloc", "ops/sec", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "peak MB", "frag");
+
+    fflush(stdout);
+
+    // each allocator runs in a child of its own, so neither one sees the
+    // other's heap and the peak RSS is its own
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+        if (only != NULL && strcmp(only, allocators[i].name) != 0)
+            continue;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(&r, &allocators[i]);
+            _exit(0);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fprintf(stderr, "%s: replay failed\n", allocators[i].name);
+    }
+    return 0;
+}
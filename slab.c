@@ -0,0 +1,129 @@
+#include "include/slab.h"
+
+#include <string.h>
+
+// objects start right after the header, aligned like a size class
+#define SLAB_HEADER_SZ ((sizeof(slab_t) + SLAB_CLASS_SZ - 1) & ~(size_t) (SLAB_CLASS_SZ - 1))
+
+static slab_t *slab_of(void *p) {
+    return (slab_t *) ((uintptr_t) p & ~(uintptr_t) (SLAB_SIZE - 1));
+}
+
+static size_t slab_bit(heap_t *heap, slab_t *slab) {
+    return ((uintptr_t) slab - (uintptr_t) heap->start) >> SLAB_SHIFT;
+}
+
+static void link_slab(heap_t *heap, uint cls, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = heap->slabs[cls];
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+    heap->slabs[cls] = slab;
+}
+
+static void unlink_slab(heap_t *heap, uint cls, slab_t *slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        heap->slabs[cls] = slab->next;
+
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+// the map has a bit for every SLAB_SIZE block the heap can ever cover,
+// so a pointer can be told apart from a chunk without reading near it
+void slab_init(heap_t *heap, size_t limit) {
+    long range = (heap->limit ? heap->limit : heap->end) - heap->start;
+    size_t bytes = (range >> SLAB_SHIFT) / 8 + 1;
+
+    // slab_max is still 0, so the map itself comes from the bins
+    heap->slab_map = heap_alloc(heap, bytes);
+    if (heap->slab_map == NULL)
+        return;
+
+    memset(heap->slab_map, 0, bytes);
+    heap->slab_max = limit < SLAB_MAX_SZ ? limit : SLAB_MAX_SZ;
+}
+
+static slab_t *new_slab(heap_t *heap, uint cls) {
+    slab_t *slab = heap_alloc_aligned(heap, SLAB_SIZE, SLAB_SIZE);
+    if (slab == NULL)
+        return NULL;
+
+    slab->free = NULL;
+    slab->size = (cls + 1) * SLAB_CLASS_SZ;
+    slab->count = (SLAB_SIZE - SLAB_HEADER_SZ) / slab->size;
+    slab->carved = 0;
+    slab->used = 0;
+
+    size_t bit = slab_bit(heap, slab);
+    heap->slab_map[bit / 8] |= 1 << (bit % 8);
+
+    link_slab(heap, cls, slab);
+    return slab;
+}
+
+void *slab_alloc(heap_t *heap, size_t size) {
+    uint cls = (size - 1) / SLAB_CLASS_SZ;
+    slab_t *slab = heap->slabs[cls];
+
+    if (slab == NULL) {
+        slab = new_slab(heap, cls);
+        if (slab == NULL)
+            return NULL;
+    }
+
+    // reuse a freed object, or carve one that was never handed out
+    void *p = slab->free;
+    if (p != NULL)
+        slab->free = *(void **) p;
+    else
+        p = (char *) slab + SLAB_HEADER_SZ + (size_t) slab->carved++ * slab->size;
+
+    heap->counters.allocs++;
+
+    // a full slab leaves the list until one of its objects is freed
+    if (++slab->used == slab->count)
+        unlink_slab(heap, cls, slab);
+
+    return p;
+}
+
+void slab_free(heap_t *heap, void *p) {
+    slab_t *slab = slab_of(p);
+    uint cls = slab->size / SLAB_CLASS_SZ - 1;
+
+    if (slab->used == slab->count)
+        link_slab(heap, cls, slab);
+
+    *(void **) p = slab->free;
+    slab->free = p;
+    slab->used--;
+    heap->counters.frees++;
+
+    // give empty slabs back, but keep the last one of a class around so
+    // allocating and freeing one object does not map and unmap a slab
+    if (slab->used == 0 && (heap->slabs[cls] != slab || slab->next != NULL)) {
+        unlink_slab(heap, cls, slab);
+
+        size_t bit = slab_bit(heap, slab);
+        heap->slab_map[bit / 8] &= ~(1 << (bit % 8));
+
+        heap_free(heap, slab);
+    }
+}
+
+uint slab_owns(heap_t *heap, void *p) {
+    uintptr_t base = (uintptr_t) slab_of(p);
+
+    if (heap->slab_map == NULL || base < (uintptr_t) heap->start || base >= (uintptr_t) heap->end)
+        return 0;
+
+    size_t bit = slab_bit(heap, (slab_t *) base);
+    return (heap->slab_map[bit / 8] >> (bit % 8)) & 1;
+}
+
+size_t slab_size(void *p) {
+    return slab_of(p)->size;
+}
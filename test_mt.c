@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// 每个线程的迭代次数和分配大小，与 test.c 保持一致
+#define NUM_ITERATIONS 100000
+#define ALLOCATION_SIZE 1024 // 1KB
+#define NUM_ROUNDS 4         // 每个线程重复 分配/释放 的轮数
+#define MAX_THREADS 64
+
+// 所有线程在同一时刻开始计时
+static pthread_barrier_t start_barrier;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 每个线程: 分配 NUM_ITERATIONS 个块，再全部释放，重复 NUM_ROUNDS 轮
+void *worker(void *arg) {
+    void **pointers = arg;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (int round = 0; round < NUM_ROUNDS; ++round) {
+        for (int i = 0; i < NUM_ITERATIONS; ++i) {
+            pointers[i] = malloc(ALLOCATION_SIZE);
+            assert(pointers[i] != NULL);
+        }
+        for (int i = 0; i < NUM_ITERATIONS; ++i) {
+            free(pointers[i]);
+        }
+    }
+    return NULL;
+}
+
+// 用 nthreads 个线程测试 malloc/free 吞吐量，返回 ops/sec
+double test_mt_throughput(int nthreads) {
+    pthread_t threads[MAX_THREADS];
+    void **pointers[MAX_THREADS];
+
+    // 指针数组在计时开始前分配，不计入测试
+    for (int t = 0; t < nthreads; ++t) {
+        pointers[t] = malloc(sizeof(void *) * NUM_ITERATIONS);
+        assert(pointers[t] != NULL);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_create(&threads[t], NULL, worker, pointers[t]);
+    }
+
+    // 注意: clock() 统计的是所有线程的 CPU 时间，这里必须用墙钟时间
+    pthread_barrier_wait(&start_barrier);
+    double start_time = now_seconds();
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    double elapsed = now_seconds() - start_time;
+    pthread_barrier_destroy(&start_barrier);
+
+    for (int t = 0; t < nthreads; ++t) {
+        free(pointers[t]);
+    }
+
+    // 每次 malloc 和 free 各算一次操作
+    double total_ops = 2.0 * NUM_ITERATIONS * NUM_ROUNDS * nthreads;
+    return total_ops / elapsed;
+}
+
+int main(int argc, char **argv) {
+    // 默认测到在线 CPU 数，也可以通过参数指定最大线程数
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    printf("Starting multithreaded malloc/free throughput tests...\n\n");
+    printf("Iterations per thread: %d x %d rounds\n", NUM_ITERATIONS, NUM_ROUNDS);
+    printf("Allocation Size: %d bytes\n", ALLOCATION_SIZE);
+    printf("------------------------------------\n");
+    printf("%8s %20s %12s\n", "threads", "ops/sec", "speedup");
+
+    double base = 0;
+    int n = 1;
+    while (1) {
+        double ops = test_mt_throughput(n);
+        if (n == 1) base = ops;
+        printf("%8d %20.2f %11.2fx\n", n, ops, ops / base);
+
+        if (n == max_threads) break;
+        // 线程数按 2 倍增长，最后一次测试正好是 max_threads
+        n = n * 2 > max_threads ? max_threads : n * 2;
+    }
+
+    printf("\nMultithreaded throughput tests completed.\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+// shared by the tests: a random source, a fill pattern and a walk over a
+// heap that checks everything the heap keeps consistent. a test aborts on
+// the first check that fails.
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        abort(); \
+    } \
+} while (0)
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// map a heap of reserve bytes, with whatever opts the caller filled in
+static void check_init(heap_t *heap, bin_t *bins, size_t reserve) {
+    for (uint i = 0; i < BIN_COUNT; i++) {
+        bins[i].head = NULL;
+        heap->bins[i] = &bins[i];
+    }
+    CHECK(map_heap(heap, reserve));
+}
+
+// a pattern that depends on where p is, so overlapping blocks show up
+static unsigned char pattern(void *p, size_t i) {
+    return (unsigned char) (((uintptr_t) p >> 4) + i * 7);
+}
+
+static void check_fill(void *p, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        ((unsigned char *) p)[i] = pattern(p, i);
+}
+
+static void check_filled(void *p, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        CHECK(((unsigned char *) p)[i] == pattern(p, i));
+}
+
+// walk the chunks from start to end, then the bins, and check they agree:
+// the chunks tile the heap, every footer points at its header, no two free
+// chunks sit next to each other, every free chunk is in the bin its size
+// maps to and nothing else is, and the bitmaps match the bins. returns the
+// number of free chunks.
+static size_t check_heap(heap_t *heap) {
+    size_t free_chunks = 0;
+    node_t *last = NULL;
+    long at = heap->start;
+
+    while (at < heap->end) {
+        node_t *node = (node_t *) at;
+        CHECK(at % HEAP_ALIGN == 0);
+        CHECK(!(node->flags & CHUNK_MMAPPED));
+
+        footer_t *foot = get_foot(node);
+        CHECK((long) foot + (long) sizeof(footer_t) <= heap->end);
+        CHECK(foot->header == node);
+
+        if (node->hole) {
+            CHECK(last == NULL || !last->hole);
+            free_chunks++;
+        }
+        else {
+            CHECK(!(node->flags & CHUNK_PURGED));
+        }
+        last = node;
+        at = (long) foot + sizeof(footer_t);
+    }
+    CHECK(at == heap->end);
+
+    size_t binned = 0;
+    for (uint i = 0; i < BIN_COUNT; i++) {
+        node_t *head = heap->bins[i]->head;
+        uint fl = i / SL_INDEX_COUNT, sl = i % SL_INDEX_COUNT;
+        CHECK(((heap->sl_bitmap[fl] >> sl) & 1) == (head != NULL));
+
+        node_t *prev = NULL;
+        for (node_t *node = head; node != NULL; node = node->next) {
+            CHECK((long) node >= heap->start && (long) node < heap->end);
+            CHECK(node->prev == prev);
+            CHECK(node->hole);
+            CHECK(get_bin_index(node->size) == i);
+            CHECK(++binned <= free_chunks); // a cycle ends here too
+            prev = node;
+        }
+    }
+    for (uint fl = 0; fl < FL_INDEX_COUNT; fl++)
+        CHECK(((heap->fl_bitmap >> fl) & 1) == (heap->sl_bitmap[fl] != 0));
+
+    CHECK(binned == free_chunks);
+    return free_chunks;
+}
+
+#endif
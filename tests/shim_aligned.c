@@ -0,0 +1,52 @@
+// posix_memalign, aligned_alloc and memalign through libmyalloc.so: bad
+// alignments are refused with EINVAL, and good ones are met.
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+int main(void) {
+    void *p = (void *) 1;
+
+    // not a power of two, or not a multiple of sizeof(void *)
+    size_t bad[] = { 0, 1, 2, 4, sizeof(void *) + 1, 24, 3 * sizeof(void *), SIZE_MAX };
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+        CHECK(posix_memalign(&p, bad[k], 64) == EINVAL);
+        CHECK(p == (void *) 1); // left alone on failure
+    }
+
+    size_t count = 0;
+    for (size_t align = sizeof(void *); align <= (size_t) 1 << 20; align <<= 1) {
+        for (size_t size = 0; size <= 4096; size += 1 + size / 2) {
+            CHECK(posix_memalign(&p, align, size) == 0);
+            CHECK((uintptr_t) p % align == 0);
+            memset(p, 0xa5, size);
+            free(p);
+
+            p = aligned_alloc(align, size);
+            CHECK(size == 0 || p != NULL);
+            CHECK((uintptr_t) p % align == 0);
+            free(p);
+
+            p = memalign(align, size);
+            CHECK(size == 0 || p != NULL);
+            CHECK((uintptr_t) p % align == 0);
+            free(p);
+            count += 3;
+        }
+    }
+
+    printf("shim_aligned: ok, %zu aligned allocations\n", count);
+    return 0;
+}
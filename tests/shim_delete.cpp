@@ -0,0 +1,55 @@
+// sized operator delete through libmyalloc.so: it frees with free_sized, so
+// the chunk must come straight back from the next operator new of the same
+// size, see shim_sized.c.
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                         __LINE__, #cond);                                  \
+            std::abort();                                                   \
+        }                                                                   \
+    } while (0)
+
+// sizes no multiple of 16, as most objects are
+struct obj24 { char c[24]; };
+struct obj300 { char c[300]; };
+struct obj1000 { char c[1000]; };
+
+template <typename T>
+static void check_delete() {
+    T *p = new T;
+    delete p;
+    T *q = new T;
+    CHECK(q == p);
+    delete q;
+}
+
+int main() {
+    size_t hits = 0;
+
+    for (size_t n = 1; n <= 1024; n++) {
+        void *p = ::operator new(n);
+        ::operator delete(p, n);
+        CHECK(::operator new(n) == p);
+        ::operator delete(p, n);
+
+        p = ::operator new[](n);
+        ::operator delete[](p, n);
+        CHECK(::operator new[](n) == p);
+        ::operator delete[](p, n);
+        hits += 2;
+    }
+
+    // what the compiler emits for delete with -fsized-deallocation
+    check_delete<obj24>();
+    check_delete<obj300>();
+    check_delete<obj1000>();
+    hits += 3;
+
+    std::printf("shim_delete: ok, %zu sized deletes cached\n", hits);
+    return 0;
+}
@@ -0,0 +1,93 @@
+// fork while other threads allocate and free through libmyalloc.so. the
+// child gets only the forking thread, so a lock another thread held at the
+// fork would never be released: the child visits every CPU, and so every
+// arena, and must be able to allocate on each.
+#define _GNU_SOURCE // sched_setaffinity
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+#define THREADS 4
+#define FORKS 200
+
+static volatile int done;
+
+// sizes past the thread cache, so every call takes an arena lock
+static void *churn_thread(void *arg) {
+    unsigned seed = (unsigned) (size_t) arg;
+    void *ptrs[64];
+    memset(ptrs, 0, sizeof(ptrs));
+    while (!done) {
+        int i = rand_r(&seed) % 64;
+        free(ptrs[i]);
+        ptrs[i] = malloc(2048 + rand_r(&seed) % 8192);
+        CHECK(ptrs[i] != NULL);
+    }
+    for (int i = 0; i < 64; i++)
+        free(ptrs[i]);
+    return NULL;
+}
+
+static void child(void) {
+    alarm(5); // a deadlock ends here
+    cpu_set_t cpus;
+    CHECK(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &cpus))
+            continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        sched_setaffinity(0, sizeof(one), &one);
+        for (int i = 0; i < 16; i++) {
+            void *volatile p = malloc(2048 + i * 512);
+            CHECK(p != NULL);
+            free(p);
+            p = malloc(16 + i * 16); // and through the thread cache
+            CHECK(p != NULL);
+            free(p);
+        }
+    }
+    _exit(0);
+}
+
+int main(void) {
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, churn_thread, (void *) (size_t) (i + 1)) == 0);
+
+    for (int f = 0; f < FORKS; f++) {
+        void *volatile p = malloc(100); // the forking thread has a cache too
+        pid_t pid = fork();
+        CHECK(pid >= 0);
+        if (pid == 0)
+            child();
+        free(p);
+
+        int status;
+        CHECK(waitpid(pid, &status, 0) == pid);
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "child %d killed by signal %d\n", f, WTERMSIG(status));
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    done = 1;
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    printf("shim_fork: ok, %d forks\n", FORKS);
+    return 0;
+}
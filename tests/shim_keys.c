@@ -0,0 +1,59 @@
+// a thread cache key past the first 32: glibc callocs the block for such
+// keys in pthread_setspecific, which must not recurse into setting up the
+// cache again. built twice, see the Makefile: as a library that takes the
+// first keys before libmyalloc.so can, and as the program using it.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+#define EARLY_KEYS 40
+
+#ifdef SHIM_KEYS_LIB
+
+pthread_key_t early_keys[EARLY_KEYS];
+
+// linked with -z initfirst, so this runs before anything can malloc
+__attribute__((constructor))
+static void take_keys(void) {
+    for (int i = 0; i < EARLY_KEYS; i++)
+        pthread_key_create(&early_keys[i], NULL);
+}
+
+#else
+
+extern pthread_key_t early_keys[EARLY_KEYS];
+
+static void *thread(void *arg) {
+    (void) arg;
+    void *volatile p = malloc(100);
+    CHECK(p != NULL);
+    free(p);
+    return NULL;
+}
+
+int main(void) {
+    // the cache's key came after these
+    CHECK(early_keys[EARLY_KEYS - 1] >= 32);
+
+    void *volatile p = malloc(100);
+    CHECK(p != NULL);
+    free(p);
+
+    pthread_t t;
+    CHECK(pthread_create(&t, NULL, thread, NULL) == 0);
+    CHECK(pthread_join(t, NULL) == 0);
+
+    printf("shim_keys: ok, thread cache set up past key %u\n", early_keys[EARLY_KEYS - 1]);
+    return 0;
+}
+
+#endif
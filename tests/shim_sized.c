@@ -0,0 +1,56 @@
+// free_sized through libmyalloc.so: a small chunk freed with the size it
+// was asked for must land in the thread cache class malloc looks that size
+// up in, so the next malloc of the same size gets it straight back.
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #cond);                                       \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+// C23, not declared by every libc yet
+void free_sized(void *ptr, size_t size);
+
+int main(void) {
+    size_t hits = 0;
+
+    // every small size, not only multiples of the class size
+    for (size_t n = 1; n <= 1024; n++) {
+        void *p = malloc(n);
+        CHECK(p != NULL);
+        free_sized(p, n);
+        CHECK(malloc(n) == p);
+        free_sized(p, n);
+        hits++;
+    }
+
+    // shrunk in place by realloc
+    for (size_t n = 1; n <= 512; n++) {
+        void *p = malloc(1024);
+        CHECK(p != NULL);
+        p = realloc(p, n);
+        CHECK(p != NULL);
+        free_sized(p, n);
+        CHECK(malloc(n) == p);
+        free_sized(p, n);
+        hits++;
+    }
+
+    // over-aligned chunks come from the heap, not the cache
+    for (size_t n = 1; n <= 1024; n += 7) {
+        void *p = aligned_alloc(64, n);
+        CHECK(p != NULL && (size_t) p % 64 == 0);
+        free_sized(p, n);
+        CHECK(malloc(n) == p);
+        free_sized(p, n);
+        hits++;
+    }
+
+    printf("shim_sized: ok, %zu sized frees cached\n", hits);
+    return 0;
+}
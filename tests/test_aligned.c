@@ -0,0 +1,70 @@
+// heap_alloc_aligned mixed with plain allocations and frees: every pointer
+// is aligned as asked, the gaps split off in front go back to the bins, and
+// the heap stays whole.
+#include "check.h"
+
+#include <string.h>
+
+#define SLOTS 256
+#define ROUNDS 20000
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+int main(void) {
+    void *ptrs[SLOTS];
+    size_t sizes[SLOTS];
+    memset(ptrs, 0, sizeof(ptrs));
+
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    size_t aligned = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        int i = rng() % SLOTS;
+        if (ptrs[i] != NULL) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+            ptrs[i] = NULL;
+            continue;
+        }
+
+        sizes[i] = 1 + rng() % 2048;
+        if (rng() % 2) {
+            size_t align = (size_t) 1 << (rng() % 17); // up to 64K
+            ptrs[i] = heap_alloc_aligned(&heap, align, sizes[i]);
+            CHECK(ptrs[i] != NULL);
+            CHECK((uintptr_t) ptrs[i] % align == 0);
+            aligned++;
+        }
+        else {
+            ptrs[i] = heap_alloc(&heap, sizes[i]);
+            CHECK(ptrs[i] != NULL);
+        }
+        CHECK((uintptr_t) ptrs[i] % HEAP_ALIGN == 0);
+        CHECK(heap_usable_size(&heap, ptrs[i]) >= sizes[i]);
+        check_fill(ptrs[i], sizes[i]);
+
+        if (r % 500 == 0)
+            check_heap(&heap);
+    }
+
+    // alignments no heap can meet fail, and leave the heap as it was
+    CHECK(heap_alloc_aligned(&heap, (size_t) 1 << 62, 16) == NULL);
+    check_heap(&heap);
+
+    for (int i = 0; i < SLOTS; i++) {
+        if (ptrs[i] != NULL) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+        }
+    }
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    printf("aligned: ok, %zu aligned chunks\n", aligned);
+    unmap_heap(&heap);
+    return 0;
+}
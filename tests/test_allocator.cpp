@@ -0,0 +1,157 @@
+// heap_allocator: standard containers take every byte from the heap their
+// allocator names, rebound allocators (the nodes of a map) stay with that
+// heap, allocators compare equal exactly when their heaps are the same,
+// moves and swaps carry the heap along, and each heap is whole again once
+// its containers are gone.
+#include "check.h"
+#include "heap_allocator.hpp"
+
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static heap_t one, two;
+static bin_t one_bins[BIN_COUNT], two_bins[BIN_COUNT];
+
+struct alignas(64) line {
+    uint64_t value;
+};
+
+template <typename T>
+using heap_vector = std::vector<T, heap_allocator<T>>;
+
+using heap_map = std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                    heap_allocator<std::pair<const uint64_t, uint64_t>>>;
+
+static bool owns(heap_t *heap, const void *p) {
+    return (uintptr_t) p >= (uintptr_t) heap->start && (uintptr_t) p < (uintptr_t) heap->end;
+}
+
+static size_t allocs(heap_t *heap) {
+    heap_stats_t stats;
+    heap_get_stats(heap, &stats);
+    return stats.counters.allocs;
+}
+
+static void check_equality(void) {
+    heap_allocator<int> a(&one), b(&two), same(&one);
+    CHECK(a == same && !(a != same));
+    CHECK(a != b && !(a == b));
+
+    // rebinding keeps the heap, so the rebound allocator frees what the
+    // original allocated and the other way round
+    heap_allocator<double> rebound(a);
+    CHECK(rebound.heap() == &one);
+    CHECK(rebound == a && rebound != b);
+    using traits = std::allocator_traits<heap_allocator<int>>;
+    traits::rebind_alloc<line> lines(b);
+    CHECK(lines == b && lines != a);
+    CHECK(heap_allocator<int>(lines) == b);
+
+    int *p = a.allocate(10);
+    heap_allocator<int>(rebound).deallocate(p, 10);
+
+    // zero objects still get a pointer, and too many throw
+    p = a.allocate(0);
+    CHECK(p != nullptr);
+    a.deallocate(p, 0);
+    bool thrown = false;
+    try {
+        a.allocate(SIZE_MAX / 2);
+    }
+    catch (const std::bad_array_new_length &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    thrown = false;
+    try {
+        a.allocate(SIZE_MAX / 2 / sizeof(int));
+    }
+    catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void check_vectors(void) {
+    heap_vector<uint64_t> v{heap_allocator<uint64_t>(&one)};
+    for (uint64_t i = 0; i < 100000; i++) {
+        v.push_back(i * 7);
+        CHECK(owns(&one, v.data()));
+    }
+    for (uint64_t i = 0; i < v.size(); i++)
+        CHECK(v[i] == i * 7);
+
+    // over-aligned elements go through heap_alloc_aligned
+    heap_vector<line> lines{heap_allocator<line>(&two)};
+    for (uint64_t i = 0; i < 1000; i++) {
+        lines.push_back(line{i});
+        CHECK((uintptr_t) lines.data() % alignof(line) == 0);
+        CHECK(owns(&two, lines.data()));
+    }
+
+    // a copy stays in its heap, a move and a swap take the heap along
+    heap_vector<uint64_t> copy(v);
+    CHECK(copy.get_allocator() == v.get_allocator() && owns(&one, copy.data()));
+    heap_vector<uint64_t> other{heap_allocator<uint64_t>(&two)};
+    other.assign(50, 1);
+    CHECK(owns(&two, other.data()));
+    other.swap(copy);
+    CHECK(other.get_allocator().heap() == &one && copy.get_allocator().heap() == &two);
+    CHECK(owns(&one, other.data()) && other.size() == v.size());
+    copy = std::move(v);
+    CHECK(copy.get_allocator().heap() == &one && owns(&one, copy.data()));
+    CHECK(copy[99999] == 99999 * 7);
+}
+
+static void check_map(void) {
+    size_t before = allocs(&two);
+    {
+        heap_map map(16, std::hash<uint64_t>(), std::equal_to<uint64_t>(),
+                     heap_map::allocator_type(&two));
+        for (uint64_t i = 0; i < 20000; i++)
+            map[i * 31] = i;
+        for (uint64_t i = 0; i < 20000; i += 2)
+            map.erase(i * 31);
+        map.rehash(100000);
+        for (uint64_t i = 0; i < 20000; i++) {
+            auto it = map.find(i * 31);
+            CHECK(i % 2 ? it != map.end() && it->second == i : it == map.end());
+            if (it != map.end())
+                CHECK(owns(&two, &*it));
+        }
+        CHECK(map.get_allocator().heap() == &two);
+    }
+    // the nodes and the buckets all came from this heap
+    CHECK(allocs(&two) - before > 20000);
+}
+
+static void check_empty(heap_t *heap) {
+    CHECK(check_heap(heap) == 1);
+    heap_stats_t stats;
+    heap_get_stats(heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+}
+
+int main(void) {
+    heap_t *heaps[] = { &one, &two };
+    bin_t *bins[] = { one_bins, two_bins };
+    for (int i = 0; i < 2; i++) {
+        heaps[i]->opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+        heaps[i]->opts.mmap_threshold = SIZE_MAX;  // and stays inside the heap
+        check_init(heaps[i], bins[i], HEAP_INIT_SIZE);
+    }
+
+    check_equality();
+    check_vectors();
+    check_map();
+
+    check_empty(&one);
+    check_empty(&two);
+    printf("allocator: ok, %zu and %zu chunks from two heaps\n", allocs(&one), allocs(&two));
+    unmap_heap(&one);
+    unmap_heap(&two);
+    return 0;
+}
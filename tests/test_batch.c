@@ -0,0 +1,124 @@
+// heap_alloc_batch and heap_free_batch mixed with single allocations and
+// frees: every batch gets n distinct chunks that do not overlap, frees in
+// any order, with holes and NULLs, join and coalesce the runs correctly,
+// and the heap stays whole. slab and mapped sizes go through too.
+#include "check.h"
+
+#include <string.h>
+
+#define BATCHES 32
+#define BATCH_MAX 128
+#define ROUNDS 1000
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+static void *batch[BATCHES][BATCH_MAX];
+static size_t counts[BATCHES], sizes[BATCHES];
+
+static void shuffle(void **ptrs, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng() % i;
+        void *t = ptrs[i - 1];
+        ptrs[i - 1] = ptrs[j];
+        ptrs[j] = t;
+    }
+}
+
+static size_t random_size(void) {
+    switch (rng() % 8) {
+    case 0:
+        return 1 + rng() % SLAB_MAX_SZ;
+    case 1:
+        return 16 * 1024 + rng() % (16 * 1024); // mapped, see below
+    default:
+        return 1 + rng() % 4096;
+    }
+}
+
+static void free_batch(int b) {
+    for (size_t i = 0; i < counts[b]; i++)
+        check_filled(batch[b][i], sizes[b]);
+
+    // in order, shuffled, or with some freed one by one and NULLed out
+    switch (rng() % 3) {
+    case 1:
+        shuffle(batch[b], counts[b]);
+        break;
+    case 2:
+        for (size_t i = 0; i < counts[b]; i++) {
+            if (rng() % 4 == 0) {
+                heap_free(&heap, batch[b][i]);
+                batch[b][i] = NULL;
+            }
+        }
+        break;
+    }
+    heap_free_batch(&heap, batch[b], counts[b]);
+    counts[b] = 0;
+}
+
+static size_t workload(size_t slab_limit) {
+    size_t chunks = 0;
+    memset(&heap, 0, sizeof(heap));
+    memset(counts, 0, sizeof(counts));
+    heap.opts.slab_limit = slab_limit;
+    heap.opts.mmap_threshold = 16 * 1024;
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        int b = rng() % BATCHES;
+        if (counts[b] != 0) {
+            free_batch(b);
+        }
+        else {
+            size_t n = 1 + rng() % BATCH_MAX;
+            sizes[b] = random_size();
+            counts[b] = heap_alloc_batch(&heap, sizes[b], n, batch[b]);
+            CHECK(counts[b] == n);
+            for (size_t i = 0; i < n; i++) {
+                CHECK(batch[b][i] != NULL);
+                CHECK((uintptr_t) batch[b][i] % HEAP_ALIGN == 0);
+                CHECK(heap_usable_size(&heap, batch[b][i]) >= sizes[b]);
+                check_fill(batch[b][i], sizes[b]);
+            }
+            chunks += n;
+        }
+
+        // single chunks in between, so batches land next to other chunks
+        void *p = heap_alloc(&heap, 1 + rng() % 1024);
+        CHECK(p != NULL);
+        if (rng() % 2)
+            heap_free(&heap, p);
+        else
+            heap_free_batch(&heap, &p, 1);
+
+        if (r % 100 == 0)
+            check_heap(&heap);
+    }
+
+    for (int b = 0; b < BATCHES; b++) {
+        if (counts[b] != 0)
+            free_batch(b);
+    }
+    size_t free_chunks = check_heap(&heap);
+
+    // slab blocks stay with their slabs, everything else comes back
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.mmaps == stats.counters.munmaps);
+    if (slab_limit == HEAP_SLAB_OFF) {
+        CHECK(free_chunks == 1);
+        CHECK(stats.counters.allocs == stats.counters.frees);
+    }
+    unmap_heap(&heap);
+    return chunks;
+}
+
+int main(void) {
+    size_t chunks = workload(HEAP_SLAB_OFF);
+    chunks += workload(0);
+
+    printf("batch: ok, %zu chunks in batches\n", chunks);
+    return 0;
+}
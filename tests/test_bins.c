@@ -0,0 +1,131 @@
+// the size classes, and the bins and bitmaps under a random workload with
+// every fit and insert policy. sizes too big for any bin must be searched
+// for without reading past the bitmaps, which the bounds checks the tests
+// are built with catch.
+#include "check.h"
+
+#include <string.h>
+
+#define SLOTS 512
+#define ROUNDS 20000
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+// a chunk of a size in class get_fit_index(sz) is always big enough, and
+// it is the first such class
+static void check_classes(size_t sz) {
+    uint fit = get_fit_index(sz);
+    uint bin = get_bin_index(sz);
+    CHECK(fit <= BIN_COUNT);
+    CHECK(bin <= fit && fit <= bin + 1);
+    CHECK(get_bin_index(sz - 1) < fit || fit == BIN_COUNT);
+    CHECK(get_bin_index(sz - 1) <= bin);
+}
+
+// a size up to max bytes, mostly small, like most programs ask for
+static size_t random_size(size_t max) {
+    size_t sz = 1 + rng() % (rng() % 8 == 0 ? max : 512);
+    return sz > max ? max : sz;
+}
+
+static void workload(uint fit, uint insert) {
+    void *ptrs[SLOTS];
+    size_t sizes[SLOTS];
+    memset(ptrs, 0, sizeof(ptrs));
+
+    memset(&heap, 0, sizeof(heap));
+    heap.opts.fit = fit;
+    heap.opts.insert = insert;
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    heap.opts.mmap_threshold = SIZE_MAX;  // so no size leaves the bins
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        int i = rng() % SLOTS;
+        if (ptrs[i] == NULL) {
+            sizes[i] = random_size(1 << 18);
+            ptrs[i] = heap_alloc(&heap, sizes[i]);
+            CHECK(ptrs[i] != NULL);
+            check_fill(ptrs[i], sizes[i]);
+        }
+        else if (rng() % 4 == 0) {
+            size_t sz = random_size(1 << 18);
+            check_filled(ptrs[i], sizes[i]);
+            ptrs[i] = heap_realloc(&heap, ptrs[i], sz);
+            CHECK(ptrs[i] != NULL);
+            sizes[i] = sz;
+            check_fill(ptrs[i], sz);
+        }
+        else {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+            ptrs[i] = NULL;
+        }
+
+        if (r % 500 == 0)
+            check_heap(&heap);
+    }
+
+    // nothing fits these, and the heap must not change
+    size_t huge[] = { (size_t) 1 << FL_INDEX_MAX, ((size_t) 1 << FL_INDEX_MAX) - 1, SIZE_MAX / 2 };
+    for (size_t k = 0; k < sizeof(huge) / sizeof(huge[0]); k++)
+        CHECK(heap_alloc(&heap, huge[k]) == NULL);
+    check_heap(&heap);
+
+    for (int i = 0; i < SLOTS; i++) {
+        if (ptrs[i] != NULL) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+        }
+    }
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    unmap_heap(&heap);
+}
+
+// only a heap that can grow past 1 << FL_INDEX_MAX bytes searches the bins
+// for sizes that big. the address space is only reserved, and the search
+// may grow the heap or fail
+static void too_big(uint fit) {
+    memset(&heap, 0, sizeof(heap));
+    heap.opts.fit = fit;
+    heap.opts.slab_limit = HEAP_SLAB_OFF;
+    heap.opts.mmap_threshold = SIZE_MAX;
+    check_init(&heap, bins, (size_t) 2 << FL_INDEX_MAX);
+
+    void *small = heap_alloc(&heap, 100);
+    CHECK(small != NULL);
+    void *p = heap_alloc(&heap, (size_t) 1 << FL_INDEX_MAX);
+    if (p != NULL)
+        heap_free(&heap, p);
+    heap_free(&heap, small);
+    CHECK(check_heap(&heap) == 1);
+    unmap_heap(&heap);
+}
+
+int main(void) {
+    for (size_t sz = 1; sz < 1 << 16; sz++)
+        check_classes(sz);
+    for (int i = 0; i < 100000; i++)
+        check_classes(1 + rng() % ((size_t) 1 << FL_INDEX_MAX));
+    for (uint bit = 4; bit < 64; bit++) {
+        check_classes((size_t) 1 << bit);
+        check_classes(((size_t) 1 << bit) + 1);
+    }
+    CHECK(get_fit_index((size_t) 1 << FL_INDEX_MAX) == BIN_COUNT);
+
+    int runs = 0;
+    for (uint fit = HEAP_FIT_GOOD; fit <= HEAP_FIT_FIRST; fit++) {
+        for (uint insert = HEAP_INSERT_LIFO; insert <= HEAP_INSERT_ADDR; insert++) {
+            workload(fit, insert);
+            runs++;
+        }
+        too_big(fit);
+    }
+    printf("bins: ok, %d policies\n", runs);
+    return 0;
+}
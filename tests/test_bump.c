@@ -0,0 +1,168 @@
+// bump spans (heap_bump_reserve, heap_bump_alloc, heap_bump_release): a
+// span is carved front to back into chunks that tile it, without the heap,
+// while other threads allocate and free around it, and the part not carved
+// goes back when the span is released. every carved chunk counts as an
+// allocation, and the heap must be whole at the end.
+#include "check.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define THREADS 4
+#define ROUNDS 2000
+#define KEEP 64
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t spans, carved;
+
+// rng is not for threads, each has its own state
+static uint64_t next(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+// one span by hand: the chunks follow each other until what is left of
+// the span is too small for one more
+static void single(void) {
+    bump_t bump;
+    void *ptrs[BUMP_SPAN_SIZE / 128];
+    size_t n = 0;
+
+    CHECK(!heap_bump_reserve(&heap, &bump, 4096, 1024)); // span below size
+    CHECK(heap_bump_reserve(&heap, &bump, 200, BUMP_SPAN_SIZE));
+    while ((ptrs[n] = heap_bump_alloc(&bump, 200)) != NULL) {
+        CHECK((uintptr_t) ptrs[n] % HEAP_ALIGN == 0);
+        CHECK(heap_usable_size(&heap, ptrs[n]) >= 200);
+        if (n > 0)
+            CHECK((char *) ptrs[n] == (char *) ptrs[n - 1] + heap_usable_size(&heap, ptrs[n - 1]) + overhead);
+        check_fill(ptrs[n], 200);
+        n++;
+    }
+    CHECK(bump.carved == n && n > 1000);
+    if (bump.rest != NULL)
+        CHECK(bump.rest->size < 200 && &bump.rest->next == (void *) ((char *) ptrs[n - 1] + heap_usable_size(&heap, ptrs[n - 1]) + overhead));
+    heap_bump_release(&heap, &bump);
+    check_heap(&heap);
+    for (size_t i = 0; i < n; i++) {
+        check_filled(ptrs[i], 200);
+        heap_free(&heap, ptrs[i]);
+    }
+    CHECK(check_heap(&heap) == 1);
+
+    // a few chunks, then the rest of the span is freed on release
+    CHECK(heap_bump_reserve(&heap, &bump, 64, BUMP_SPAN_SIZE));
+    for (n = 0; n < 8; n++)
+        ptrs[n] = heap_bump_alloc(&bump, 64);
+    heap_bump_release(&heap, &bump);
+    CHECK(bump.rest == NULL && heap_bump_alloc(&bump, 64) == NULL);
+    CHECK(check_heap(&heap) == 1); // the rest went back into the wilderness
+    for (size_t i = 0; i < n; i++)
+        heap_free(&heap, ptrs[i]);
+    CHECK(check_heap(&heap) == 1);
+
+    // two spans side by side: the rest of the first is freed with the
+    // second still carved after it, so only its own footer bounds it
+    bump_t second;
+    CHECK(heap_bump_reserve(&heap, &bump, 64, BUMP_SPAN_SIZE));
+    CHECK(heap_bump_reserve(&heap, &second, 64, BUMP_SPAN_SIZE));
+    for (n = 0; n < 8; n++) {
+        ptrs[2 * n] = heap_bump_alloc(&bump, 64);
+        ptrs[2 * n + 1] = heap_bump_alloc(&second, 64);
+    }
+    heap_bump_release(&heap, &bump);
+    CHECK(check_heap(&heap) == 2);
+    heap_bump_release(&heap, &second);
+    for (size_t i = 0; i < 2 * n; i++)
+        heap_free(&heap, ptrs[i]);
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+}
+
+// reserve a span under the lock, carve a random number of chunks from it
+// without, and free them under the lock, some before the span is released
+// and some after, while other threads carve the spans next to it
+static void *bump_thread(void *arg) {
+    uint64_t s = 88172645463325252ULL + (uintptr_t) arg;
+    void *ptrs[KEEP];
+    size_t sizes[KEEP];
+    size_t mine = 0, chunks = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        bump_t bump;
+        size_t size = 16 + next(&s) % 2048;
+        int n = 1 + next(&s) % KEEP;
+
+        pthread_mutex_lock(&lock);
+        uint reserved = heap_bump_reserve(&heap, &bump, size, BUMP_SPAN_SIZE / 4);
+        pthread_mutex_unlock(&lock);
+        if (!reserved)
+            bump.rest = NULL; // a fit elsewhere, carve nothing this round
+        else
+            mine++;
+
+        int k = 0;
+        for (; k < n; k++) {
+            sizes[k] = 1 + next(&s) % size;
+            if ((ptrs[k] = heap_bump_alloc(&bump, sizes[k])) == NULL)
+                break;
+            check_fill(ptrs[k], sizes[k]);
+        }
+        chunks += k;
+
+        pthread_mutex_lock(&lock);
+        for (int i = 0; i < k / 2; i++) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+        }
+        if (reserved)
+            heap_bump_release(&heap, &bump);
+        for (int i = k / 2; i < k; i++) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+        }
+
+        // and some ordinary chunks in between the spans
+        void *p = heap_alloc(&heap, 1 + next(&s) % 4096);
+        CHECK(p != NULL);
+        if (next(&s) % 2)
+            heap_free(&heap, p);
+        else
+            heap_free_remote(&heap, p);
+        pthread_mutex_unlock(&lock);
+    }
+
+    __atomic_add_fetch(&spans, mine, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&carved, chunks, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int main(void) {
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    single();
+
+    pthread_t threads[THREADS];
+    for (uintptr_t i = 0; i < THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, bump_thread, (void *) i) == 0);
+    for (int i = 0; i < THREADS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    CHECK(spans > THREADS);
+
+    heap_free(&heap, heap_alloc(&heap, 16)); // drains the remote frees
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    printf("bump: ok, %zu chunks carved from %zu spans\n", carved, spans);
+    unmap_heap(&heap);
+    return 0;
+}
@@ -0,0 +1,143 @@
+// heap_calloc only clears what it has to: memory below heap->zero that was
+// handed out before, less the pages heap_purge gave back. every chunk it
+// returns must read zero anyway, however dirty the memory it was carved
+// from, with slabs and quick lists on or off, and after purging.
+#include "check.h"
+
+#include <string.h>
+
+#define SLOTS 256
+#define ROUNDS 20000
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+static void check_zero(void *p, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        CHECK(((unsigned char *) p)[i] == 0);
+}
+
+// random mallocs, callocs and frees over the same memory
+static size_t reuse(size_t slab_limit, size_t quick_limit) {
+    void *ptrs[SLOTS];
+    size_t sizes[SLOTS];
+    size_t callocs = 0;
+    memset(ptrs, 0, sizeof(ptrs));
+
+    memset(&heap, 0, sizeof(heap));
+    heap.opts.slab_limit = slab_limit;
+    heap.opts.quick_limit = quick_limit;
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        int i = rng() % SLOTS;
+        if (ptrs[i] != NULL) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+            ptrs[i] = NULL;
+            continue;
+        }
+
+        sizes[i] = 1 + rng() % (rng() % 8 == 0 ? 65536 : 1024);
+        if (rng() % 2) {
+            size_t count = 1 + rng() % 4;
+            sizes[i] = (sizes[i] + count - 1) / count * count;
+            ptrs[i] = heap_calloc(&heap, count, sizes[i] / count);
+            CHECK(ptrs[i] != NULL);
+            check_zero(ptrs[i], sizes[i]);
+            callocs++;
+        }
+        else {
+            ptrs[i] = heap_alloc(&heap, sizes[i]);
+            CHECK(ptrs[i] != NULL);
+        }
+        // dirty everything, so the next chunk carved from here needs clearing
+        check_fill(ptrs[i], sizes[i]);
+
+        if (r % 500 == 0)
+            check_heap(&heap);
+    }
+
+    for (int i = 0; i < SLOTS; i++) {
+        if (ptrs[i] != NULL)
+            heap_free(&heap, ptrs[i]);
+    }
+    check_heap(&heap);
+    unmap_heap(&heap);
+    return callocs;
+}
+
+// free big dirty chunks between ones kept in use, so they stay apart and
+// out of the wilderness, purge them, then calloc from them: whole, split,
+// and after some of them were dirtied again. with purge_lazy the pages are
+// not known to be zero, and must be cleared like any others.
+static size_t purge(uint lazy) {
+    enum { BIG = 256 * 1024, COUNT = 64 };
+    void *big[COUNT], *keep[COUNT];
+    size_t callocs = 0;
+
+    memset(&heap, 0, sizeof(heap));
+    heap.opts.slab_limit = HEAP_SLAB_OFF;
+    heap.opts.purge_limit = PURGE_MIN_SZ;
+    heap.opts.purge_decay = 0;
+    heap.opts.purge_lazy = lazy;
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < COUNT; i++) {
+            big[i] = heap_alloc(&heap, BIG);
+            keep[i] = heap_alloc(&heap, 64);
+            CHECK(big[i] != NULL && keep[i] != NULL);
+            check_fill(big[i], BIG);
+        }
+        for (int i = 0; i < COUNT; i++)
+            heap_free(&heap, big[i]);
+
+        CHECK(heap_purge(&heap) > 0);
+        check_heap(&heap);
+
+        for (int i = 0; i < COUNT; i++) {
+            size_t size = i % 2 ? BIG : 1 + rng() % BIG;
+            big[i] = heap_calloc(&heap, 1, size);
+            CHECK(big[i] != NULL);
+            check_zero(big[i], size);
+            callocs++;
+            // some go back dirty, over purged and unpurged pages alike
+            if (i % 3 == 0) {
+                check_fill(big[i], size);
+                heap_free(&heap, big[i]);
+                big[i] = heap_calloc(&heap, 1, size);
+                CHECK(big[i] != NULL);
+                check_zero(big[i], size);
+                callocs++;
+            }
+        }
+        for (int i = 0; i < COUNT; i++) {
+            heap_free(&heap, big[i]);
+            heap_free(&heap, keep[i]);
+        }
+        check_heap(&heap);
+    }
+
+    unmap_heap(&heap);
+    return callocs;
+}
+
+int main(void) {
+    size_t callocs = 0;
+    callocs += reuse(HEAP_SLAB_OFF, 0);
+    callocs += reuse(0, 0);
+    callocs += reuse(HEAP_SLAB_OFF, QUICK_MAX_SZ);
+    callocs += reuse(0, QUICK_MAX_SZ);
+    callocs += purge(0);
+    callocs += purge(1);
+
+    // count * size that overflows is refused, not wrapped
+    memset(&heap, 0, sizeof(heap));
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+    CHECK(heap_calloc(&heap, SIZE_MAX / 2, 3) == NULL);
+    unmap_heap(&heap);
+
+    printf("calloc: ok, %zu callocs zeroed\n", callocs);
+    return 0;
+}
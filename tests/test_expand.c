@@ -0,0 +1,138 @@
+// a mapped heap grows with expand as chunks are asked for and gives pages
+// back with contract as they are freed, staying inside its reservation and
+// whole all the while. pages it maps in again must read zero. with huge
+// pages on it only ever moves its end by whole huge pages.
+#include "check.h"
+
+#include <string.h>
+
+#define RESERVE ((size_t) 256 << 20)
+#define SLOTS 256
+#define ROUNDS 20000
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+static size_t heap_bytes(void) {
+    return heap.end - heap.start;
+}
+
+// the heap spans whole pages of the size it was mapped with
+static void check_pages(void) {
+    CHECK(heap_bytes() % heap.page == 0);
+    if (heap.opts.huge != HEAP_HUGE_OFF)
+        CHECK(heap_bytes() % HEAP_HUGE_PAGE_SIZE == 0);
+}
+
+static size_t run(uint huge) {
+    void *ptrs[SLOTS];
+    size_t sizes[SLOTS];
+    memset(ptrs, 0, sizeof(ptrs));
+
+    memset(&heap, 0, sizeof(heap));
+    heap.opts.slab_limit = HEAP_SLAB_OFF;
+    heap.opts.mmap_threshold = SIZE_MAX; // so big chunks grow the heap too
+    heap.opts.huge = huge;
+    check_init(&heap, bins, RESERVE);
+    if (huge != HEAP_HUGE_OFF) {
+        CHECK(heap.page == HEAP_HUGE_PAGE_SIZE);
+        CHECK(heap.start % HEAP_HUGE_PAGE_SIZE == 0);
+        CHECK(heap_bytes() == HEAP_HUGE_PAGE_SIZE);
+    }
+    else {
+        CHECK(heap_bytes() == HEAP_MIN_SIZE);
+    }
+
+    // expand and contract by hand move the end by whole pages
+    size_t first = heap_bytes();
+    CHECK(expand(&heap, 1));
+    CHECK(heap_bytes() == first + heap.page);
+    check_pages();
+    CHECK(!expand(&heap, RESERVE));
+    CHECK(expand(&heap, MAX_WILDERNESS));
+    check_pages();
+    size_t grown = heap_bytes();
+    contract(&heap, MAX_WILDERNESS);
+    CHECK(heap_bytes() == grown - MAX_WILDERNESS);
+    check_pages();
+    contract(&heap, heap_bytes()); // never below MIN_WILDERNESS
+    CHECK(heap_bytes() == grown - MAX_WILDERNESS);
+    check_pages();
+    CHECK(check_heap(&heap) == 1);
+
+    // grow and shrink under a random workload, with a few big chunks
+    size_t peak = 0, contracted = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        int i = rng() % SLOTS;
+        size_t before = heap_bytes();
+        if (ptrs[i] != NULL) {
+            check_filled(ptrs[i], sizes[i]);
+            heap_free(&heap, ptrs[i]);
+            ptrs[i] = NULL;
+            if (heap_bytes() < before)
+                contracted++;
+        }
+        else {
+            sizes[i] = 1 + rng() % (rng() % 16 == 0 ? 4 << 20 : 4096);
+            ptrs[i] = heap_alloc(&heap, sizes[i]);
+            CHECK(ptrs[i] != NULL);
+            check_fill(ptrs[i], sizes[i]);
+        }
+
+        check_pages();
+        CHECK(heap_bytes() <= RESERVE);
+        if (heap_bytes() > peak)
+            peak = heap_bytes();
+        if (r % 500 == 0)
+            check_heap(&heap);
+    }
+    CHECK(contracted > 0);
+
+    // more than the reservation holds fails, and changes nothing
+    size_t now = heap_bytes();
+    CHECK(heap_alloc(&heap, RESERVE) == NULL);
+    CHECK(heap_bytes() == now);
+    check_heap(&heap);
+
+    // a chunk carved from the wilderness grows in place past the end of the
+    // heap by expanding it
+    for (int i = 0; i < SLOTS; i++) {
+        if (ptrs[i] != NULL)
+            heap_free(&heap, ptrs[i]);
+    }
+    void *last = heap_alloc(&heap, 4096);
+    CHECK(last != NULL);
+    check_fill(last, 4096);
+    now = heap_bytes();
+    CHECK(heap_resize(&heap, last, now + (8 << 20)));
+    CHECK(heap_bytes() > now);
+    check_filled(last, 4096);
+    check_heap(&heap);
+
+    // everything back: the wilderness is cut down, and what is mapped in
+    // again after that reads zero
+    heap_free(&heap, last);
+    CHECK(check_heap(&heap) == 1);
+    CHECK(heap_bytes() <= MAX_WILDERNESS);
+
+    size_t big = peak / 2;
+    char *p = heap_calloc(&heap, 1, big);
+    CHECK(p != NULL);
+    for (size_t i = 0; i < big; i++)
+        CHECK(p[i] == 0);
+    heap_free(&heap, p);
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    unmap_heap(&heap);
+    return contracted;
+}
+
+int main(void) {
+    size_t contracted = run(HEAP_HUGE_OFF);
+    size_t huge = run(HEAP_HUGE_THP);
+    printf("expand: ok, contracted %zu times, %zu with huge pages\n", contracted, huge);
+    return 0;
+}
@@ -0,0 +1,163 @@
+// pools: objects are aligned and come from slabs of the pool, the last
+// object freed is the next one handed out, a slab goes back to the heap as
+// soon as it empties (except the last one with room), and the typed
+// wrapper constructs and destroys in place. the heap must be whole after
+// every teardown.
+#include "check.h"
+#include "pool.hpp"
+
+#include <stdexcept>
+#include <string.h>
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+static size_t heap_frees(void) {
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    return stats.counters.frees;
+}
+
+static size_t slabs(pool_slab_t *list) {
+    size_t n = 0;
+    for (; list != NULL; list = list->next)
+        n++;
+    return n;
+}
+
+static void check_pool(size_t size, size_t align) {
+    pool_t pool;
+    CHECK(pool_init(&pool, &heap, size, align));
+    CHECK(pool.slabs == NULL && pool.full == NULL); // nothing taken yet
+
+    // three slabs' worth, all in the slab their address masks to
+    size_t n = 3 * (size_t) pool.count;
+    void **objs = (void **) malloc(n * sizeof(void *));
+    for (size_t i = 0; i < n; i++) {
+        objs[i] = pool_alloc(&pool);
+        CHECK(objs[i] != NULL);
+        CHECK((uintptr_t) objs[i] % align == 0);
+        uintptr_t slab = (uintptr_t) objs[i] & ~(uintptr_t) (pool.slab_size - 1);
+        CHECK((uintptr_t) objs[i] >= slab + pool.header);
+        CHECK((uintptr_t) objs[i] + size <= slab + pool.slab_size);
+        check_fill(objs[i], size);
+    }
+    CHECK(slabs(pool.full) == 3 && pool.slabs == NULL);
+    check_heap(&heap);
+
+    // LIFO: the last freed is the first handed out again. the free list
+    // link went through them, so they are filled again
+    pool_free(&pool, objs[5]);
+    pool_free(&pool, objs[7]);
+    CHECK(pool_alloc(&pool) == objs[7]);
+    CHECK(pool_alloc(&pool) == objs[5]);
+    check_fill(objs[5], size);
+    check_fill(objs[7], size);
+
+    // emptying the middle slab gives it back to the heap at once, as
+    // another slab already has room
+    pool_free(&pool, objs[0]);
+    size_t frees = heap_frees();
+    for (size_t i = pool.count; i < 2 * (size_t) pool.count; i++)
+        pool_free(&pool, objs[i]);
+    CHECK(heap_frees() == frees + 1);
+    CHECK(slabs(pool.slabs) == 1 && slabs(pool.full) == 1);
+
+    // the last slab with room is kept when it empties
+    for (size_t i = 2 * (size_t) pool.count; i < n; i++)
+        pool_free(&pool, objs[i]);
+    for (size_t i = 1; i < pool.count; i++) {
+        check_filled(objs[i], size);
+        pool_free(&pool, objs[i]);
+    }
+    CHECK(slabs(pool.slabs) == 1 && pool.full == NULL);
+    CHECK(pool.slabs->used == 0);
+    check_heap(&heap);
+
+    pool_destroy(&pool);
+    CHECK(check_heap(&heap) == 1);
+    free(objs);
+}
+
+// counts live objects, and can be told to throw from its constructor
+struct alignas(64) tracked {
+    static int live;
+    uint64_t value;
+    char pad[100];
+
+    explicit tracked(uint64_t v, bool fail = false) : value(v) {
+        if (fail)
+            throw std::runtime_error("tracked");
+        memset(pad, (int) v, sizeof(pad));
+        live++;
+    }
+    ~tracked() { live--; }
+};
+
+int tracked::live = 0;
+
+static void check_wrapper(void) {
+    {
+        object_pool<tracked> objects(&heap);
+        tracked *ptrs[1000];
+        for (int i = 0; i < 1000; i++) {
+            ptrs[i] = objects.create(i);
+            CHECK((uintptr_t) ptrs[i] % alignof(tracked) == 0);
+        }
+        CHECK(tracked::live == 1000);
+        for (int i = 0; i < 1000; i += 2)
+            objects.destroy(ptrs[i]);
+        CHECK(tracked::live == 500);
+        for (int i = 1; i < 1000; i += 2)
+            CHECK(ptrs[i]->value == (uint64_t) i && ptrs[i]->pad[99] == (char) i);
+
+        // a constructor that throws gives its memory back
+        void *next = objects.allocate();
+        objects.deallocate(next);
+        bool thrown = false;
+        try {
+            objects.create(1, true);
+        }
+        catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(tracked::live == 500);
+        CHECK(objects.allocate() == next);
+        objects.deallocate(next);
+
+        objects.destroy(nullptr);
+        for (int i = 1; i < 1000; i += 2)
+            objects.destroy(ptrs[i]);
+        CHECK(tracked::live == 0);
+        // the destructor gives back the slab that is left
+    }
+    CHECK(check_heap(&heap) == 1);
+}
+
+int main(void) {
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    size_t sizes[] = { 1, 8, 24, 100, 4096, 20000 };
+    size_t aligns[] = { 1, 8, 16, 64, 4096 };
+    int pools = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+            check_pool(sizes[s], aligns[a] < sizeof(void *) ? sizeof(void *) : aligns[a]);
+            pools++;
+        }
+    }
+
+    pool_t bad;
+    CHECK(!pool_init(&bad, &heap, 64, 24)); // not a power of two
+
+    check_wrapper();
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    printf("pool: ok, %d pools and the typed wrapper\n", pools);
+    unmap_heap(&heap);
+    return 0;
+}
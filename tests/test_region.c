@@ -0,0 +1,96 @@
+// regions: every allocation is REGION_ALIGN aligned and keeps its bytes,
+// blocks chain as they fill, a rewind drops exactly what came after its
+// mark, across as many blocks as that spans, and a release gives every
+// block back to the heap.
+#include "check.h"
+#include "region.h"
+
+#include <string.h>
+
+#define MARKS 16
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+
+// allocate n blocks of random sizes, some bigger than a whole block
+static void fill(region_t *region, void **ptrs, size_t *sizes, int n) {
+    for (int i = 0; i < n; i++) {
+        sizes[i] = rng() % 16 == 0 ? 1 + rng() % (3 * region->block_size) : 1 + rng() % 512;
+        ptrs[i] = region_alloc(region, sizes[i]);
+        CHECK(ptrs[i] != NULL);
+        CHECK((uintptr_t) ptrs[i] % REGION_ALIGN == 0);
+        check_fill(ptrs[i], sizes[i]);
+    }
+}
+
+static size_t blocks(region_t *region) {
+    size_t n = 0;
+    for (region_block_t *b = region->block; b != NULL; b = b->prev)
+        n++;
+    return n;
+}
+
+int main(void) {
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    region_t region;
+    region_init(&region, &heap, 4096);
+    CHECK(region.block == NULL); // nothing taken before the first allocation
+    CHECK(region_alloc(&region, SIZE_MAX) == NULL);
+    CHECK(region_alloc(&region, SIZE_MAX - 8) == NULL);
+
+    static void *ptrs[MARKS][64];
+    static size_t sizes[MARKS][64];
+    size_t max_blocks = 0;
+
+    for (int round = 0; round < 50; round++) {
+        // nested marks, each followed by enough to start new blocks
+        region_mark_t marks[MARKS];
+        size_t depth[MARKS];
+        int n = 1 + rng() % MARKS;
+        for (int m = 0; m < n; m++) {
+            marks[m] = region_mark(&region);
+            depth[m] = blocks(&region);
+            fill(&region, ptrs[m], sizes[m], 64);
+        }
+        if (blocks(&region) > max_blocks)
+            max_blocks = blocks(&region);
+        check_heap(&heap);
+
+        // rewind to a random mark: what came before it is untouched, and
+        // the next allocation starts right where the mark was
+        int m = rng() % n;
+        region_rewind(&region, marks[m]);
+        CHECK(region.block == marks[m].block);
+        CHECK(blocks(&region) == depth[m]);
+        if (marks[m].block != NULL)
+            CHECK(region.cur == marks[m].cur);
+        for (int k = 0; k < m; k++) {
+            for (int i = 0; i < 64; i++)
+                check_filled(ptrs[k][i], sizes[k][i]);
+        }
+        check_heap(&heap);
+
+        if (marks[m].block != NULL && region.cur + 16 <= region.end)
+            CHECK(region_alloc(&region, 16) == marks[m].cur);
+
+        // and now and then everything
+        if (rng() % 4 == 0) {
+            region_release(&region);
+            CHECK(region.block == NULL && region.cur == NULL);
+            CHECK(check_heap(&heap) == 1);
+        }
+    }
+    CHECK(max_blocks > 1);
+
+    region_release(&region);
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    printf("region: ok, up to %zu blocks chained\n", max_blocks);
+    unmap_heap(&heap);
+    return 0;
+}
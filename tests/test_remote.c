@@ -0,0 +1,163 @@
+// remote frees (heap_free_remote) racing the heap's owner, and mapped
+// chunks allocated without the heap's lock, as libmyalloc.so does. every
+// chunk queued must be freed by the owner, and the heap must stay whole.
+#include "check.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define BATCH 64
+
+static heap_t heap;
+static bin_t bins[BIN_COUNT];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int done;
+static size_t queued;
+
+// allocates under the lock and frees with heap_free_remote, without it
+static void *remote_thread(void *arg) {
+    (void) arg;
+    void *ptrs[BATCH];
+    while (!done) {
+        pthread_mutex_lock(&lock);
+        for (int i = 0; i < BATCH; i++) {
+            ptrs[i] = heap_alloc(&heap, 32 + i * 40);
+            CHECK(ptrs[i] != NULL);
+        }
+        pthread_mutex_unlock(&lock);
+
+        for (int i = 0; i < BATCH; i++) {
+            check_fill(ptrs[i], 32 + i * 40);
+            heap_free_remote(&heap, ptrs[i]);
+        }
+        __atomic_add_fetch(&queued, BATCH, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// mapped chunks never take the lock, and must never touch the heap
+static void *mapped_thread(void *arg) {
+    (void) arg;
+    while (!done) {
+        void *p = heap_alloc(&heap, HEAP_MMAP_THRESHOLD);
+        CHECK(p != NULL);
+        heap_free(&heap, p);
+        p = heap_calloc(&heap, 1, HEAP_MMAP_THRESHOLD + 100);
+        CHECK(p != NULL);
+        heap_free(&heap, p);
+    }
+    return NULL;
+}
+
+// frees every chunk in ptrs with heap_free_remote
+static void *free_all_thread(void *arg) {
+    void **ptrs = arg;
+    for (int i = 0; i < BATCH; i++)
+        heap_free_remote(&heap, ptrs[i]);
+    return NULL;
+}
+
+// hand BATCH chunks of size bytes to another thread to free, and wait
+static void free_elsewhere(size_t size) {
+    void *ptrs[BATCH];
+    for (int i = 0; i < BATCH; i++) {
+        ptrs[i] = heap_alloc(&heap, size);
+        CHECK(ptrs[i] != NULL);
+    }
+    pthread_t t;
+    CHECK(pthread_create(&t, NULL, free_all_thread, ptrs) == 0);
+    CHECK(pthread_join(t, NULL) == 0);
+    CHECK(heap.remote != NULL);
+}
+
+// an owner that never allocates again still gets its chunks back: through
+// heap_get_stats, heap_purge, or a free of its own
+static void idle_owner(void) {
+    heap_stats_t stats;
+
+    free_elsewhere(1000);
+    heap_get_stats(&heap, &stats);
+    CHECK(heap.remote == NULL);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    CHECK(check_heap(&heap) == 1);
+
+    free_elsewhere(100 * 1024);
+    heap_purge(&heap);
+    CHECK(heap.remote == NULL);
+    CHECK(check_heap(&heap) == 1);
+
+    // big enough that the wilderness they merge into is contracted
+    void *mine = heap_alloc(&heap, 64);
+    free_elsewhere(512 * 1024);
+    size_t grown = heap.end - heap.start;
+    heap_free(&heap, mine);
+    CHECK(heap.remote == NULL);
+    CHECK(check_heap(&heap) == 1);
+    CHECK((size_t) (heap.end - heap.start) < grown);
+}
+
+int main(void) {
+    heap.opts.slab_limit = HEAP_SLAB_OFF; // so every chunk comes back
+    check_init(&heap, bins, HEAP_INIT_SIZE);
+
+    // with a chunk queued, mapped allocations must leave the queue to
+    // whoever holds the heap
+    void *queued_chunk = heap_alloc(&heap, 100);
+    heap_free_remote(&heap, queued_chunk);
+    heap_free(&heap, heap_alloc(&heap, HEAP_MMAP_THRESHOLD));
+    heap_free(&heap, heap_calloc(&heap, 1, HEAP_MMAP_THRESHOLD));
+    CHECK(heap.remote != NULL);
+    heap_free(&heap, heap_alloc(&heap, 100));
+    CHECK(heap.remote == NULL);
+    check_heap(&heap);
+
+    idle_owner();
+
+    pthread_t remote[2], mapped;
+    for (int i = 0; i < 2; i++)
+        CHECK(pthread_create(&remote[i], NULL, remote_thread, NULL) == 0);
+    CHECK(pthread_create(&mapped, NULL, mapped_thread, NULL) == 0);
+
+    // the owner keeps allocating, which drains the queue
+    void *own[256];
+    memset(own, 0, sizeof(own));
+    for (int r = 0; r < 20000; r++) {
+        pthread_mutex_lock(&lock);
+        int i = rng() % 256;
+        if (own[i] != NULL) {
+            check_filled(own[i], 1 + i * 8);
+            heap_free(&heap, own[i]);
+            own[i] = NULL;
+        }
+        else {
+            own[i] = heap_alloc(&heap, 1 + i * 8);
+            CHECK(own[i] != NULL);
+            check_fill(own[i], 1 + i * 8);
+        }
+        if (r % 100 == 0)
+            check_heap(&heap);
+        pthread_mutex_unlock(&lock);
+    }
+
+    done = 1;
+    for (int i = 0; i < 2; i++)
+        pthread_join(remote[i], NULL);
+    pthread_join(mapped, NULL);
+
+    // one more allocation drains what is left
+    heap_free(&heap, heap_alloc(&heap, 16));
+    CHECK(heap.remote == NULL);
+    for (int i = 0; i < 256; i++) {
+        if (own[i] != NULL)
+            heap_free(&heap, own[i]);
+    }
+    CHECK(check_heap(&heap) == 1);
+
+    heap_stats_t stats;
+    heap_get_stats(&heap, &stats);
+    CHECK(stats.counters.allocs == stats.counters.frees);
+    CHECK(stats.counters.mmaps == stats.counters.munmaps);
+    printf("remote: ok, %zu chunks freed remotely\n", queued);
+    unmap_heap(&heap);
+    return 0;
+}
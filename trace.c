@@ -0,0 +1,192 @@
+#define _GNU_SOURCE // gettid
+#include "include/trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// one ring per thread, written only by its thread and read only by the
+// drainer, so the producer side needs no lock and no atomic read-modify-write
+typedef struct trace_ring_t {
+    _Atomic uint64_t head; // next slot the thread writes
+    _Atomic uint64_t tail; // next slot the drainer reads
+    uint64_t dropped;
+    struct trace_ring_t *next;
+    uint32_t tid;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+int g_trace_on = 0;
+
+static int g_trace_fd = -1;
+static trace_ring_t *_Atomic g_rings = NULL;
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t g_ring_key; // frees a thread's ring when it exits
+static __thread trace_ring_t *t_ring __attribute__((tls_model("initial-exec")));
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// rings come straight from mmap so tracing never calls back into malloc
+static trace_ring_t *new_ring(void) {
+    trace_ring_t *ring = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return NULL;
+
+    ring->tid = gettid();
+    pthread_setspecific(g_ring_key, ring);
+    ring->next = g_rings;
+    while (!__atomic_compare_exchange_n(&g_rings, &ring->next, ring, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return ring;
+}
+
+void trace_record(uint32_t op, void *ptr, void *old, size_t size) {
+    trace_ring_t *ring = t_ring;
+    if (ring == NULL && (ring = t_ring = new_ring()) == NULL)
+        return;
+
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    trace_event_t *e = &ring->events[head % TRACE_RING_SIZE];
+    e->time = now_ns();
+    e->ptr = (uintptr_t) ptr;
+    e->old = (uintptr_t) old;
+    e->size = size;
+    e->tid = ring->tid;
+    e->op = op;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_all(const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(g_trace_fd, p, len);
+        if (n <= 0)
+            return;
+        p += n;
+        len -= n;
+    }
+}
+
+// with g_drain_lock held: copy what ring's thread has published so far
+static void drain_ring(trace_ring_t *ring) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        // write the contiguous run up to the end of the ring at once
+        uint64_t slot = tail % TRACE_RING_SIZE;
+        uint64_t run = head - tail;
+        if (run > TRACE_RING_SIZE - slot)
+            run = TRACE_RING_SIZE - slot;
+
+        write_all(&ring->events[slot], run * sizeof(trace_event_t));
+        tail += run;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+// copy everything the threads have published so far into the file
+void trace_flush(void) {
+    if (g_trace_fd < 0)
+        return;
+
+    pthread_mutex_lock(&g_drain_lock);
+    for (trace_ring_t *ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+        drain_ring(ring);
+    pthread_mutex_unlock(&g_drain_lock);
+}
+
+// runs when a thread that traced exits: write out what is left in its ring,
+// then unlink and unmap it. new rings are only ever pushed on the head of
+// g_rings, so under g_drain_lock a ring past the head can be unlinked with
+// plain stores. a thread that still traces after this, from another key's
+// destructor, gets a new ring and comes back here for it.
+static void free_ring(void *arg) {
+    trace_ring_t *ring = arg;
+    t_ring = NULL;
+
+    pthread_mutex_lock(&g_drain_lock);
+    drain_ring(ring);
+
+    trace_ring_t *expected = ring;
+    if (!__atomic_compare_exchange_n(&g_rings, &expected, ring->next, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        trace_ring_t *prev = expected;
+        while (prev->next != ring)
+            prev = prev->next;
+        prev->next = ring->next;
+    }
+    pthread_mutex_unlock(&g_drain_lock);
+
+    munmap(ring, sizeof(trace_ring_t));
+}
+
+static void *drain_thread(void *arg) {
+    (void) arg;
+    struct timespec delay = { 0, TRACE_DRAIN_MS * 1000000L };
+    for (;;) {
+        nanosleep(&delay, NULL);
+        trace_flush();
+    }
+    return NULL;
+}
+
+// the drainer may hold the lock when another thread forks, and the child,
+// which has no drainer, still takes it in trace_flush at exit
+static void drain_lock(void) {
+    pthread_mutex_lock(&g_drain_lock);
+}
+
+static void drain_unlock(void) {
+    pthread_mutex_unlock(&g_drain_lock);
+}
+
+static void drain_reset(void) {
+    pthread_mutex_init(&g_drain_lock, NULL);
+}
+
+// runs when the library is loaded, before main
+__attribute__((constructor))
+static void trace_start(void) {
+    const char *path = getenv(TRACE_ENV);
+    if (path == NULL || *path == '\0')
+        return;
+
+    g_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_trace_fd < 0)
+        return;
+
+    trace_header_t header = { TRACE_MAGIC, TRACE_VERSION, sizeof(trace_event_t) };
+    write_all(&header, sizeof(header));
+
+    if (pthread_key_create(&g_ring_key, free_ring) != 0) {
+        close(g_trace_fd);
+        g_trace_fd = -1;
+        return;
+    }
+
+    // the exit hook catches whatever the drainer has not written yet
+    atexit(trace_flush);
+    pthread_atfork(drain_lock, drain_unlock, drain_reset);
+
+    pthread_t drainer;
+    if (pthread_create(&drainer, NULL, drain_thread, NULL) == 0)
+        pthread_detach(drainer);
+
+    g_trace_on = 1;
+}